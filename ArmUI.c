@@ -1,41 +1,41 @@
 #include <stdio.h>
 #include <gtk/gtk.h> //for the gui
+#include <glib-unix.h> //for SIGUSR1 on the main loop
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <linux/joystick.h> // for joystick
 #include <pthread.h>
 #include <stdbool.h>
-
-// Path to robot arm
-#define DEVICE_PATH "/dev/A37JN_Robot_arm"
-#define MAGIC_NUM 0x80
-#define IOCTL_SET_VALUE _IOW(MAGIC_NUM, 1, struct device_command)
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <signal.h>
+
+#include "arm_control.h"
+#include "arm_input.h"
+#include "arm_latency.h"
+#include "arm_trace.h"
 
 // Depends on system (change to "js0" or "js1")
 #define JOYSTICK_DEV "/dev/input/js1"
 #define AXIS_THRESHOLD 1000
 
-//isolating input, default to mouse (0), with keyboard(2), and joystick (3)
-static int active_input_mode = 0;
+//isolating input, default to mouse (0), with keyboard(1), and joystick (2)
+//written by the GTK thread and read by the joystick thread, hence atomic
+static atomic_int active_input_mode = 0;
 static GList *control_buttons = NULL; 
 
-static bool keyboard_enabled = TRUE;
-static bool joystick_enabled = TRUE;
-
-//booleans to keep track of when a key is pressed (to prevent repeated calling)
-static gboolean key_light_on = FALSE;
-static gboolean key_light_off = FALSE;
-static gboolean key_base_pos = FALSE;
-static gboolean key_base_neg = FALSE;
-static gboolean key_shoulder_pos = FALSE;
-static gboolean key_shoulder_neg = FALSE;
-static gboolean key_elbow_pos = FALSE;
-static gboolean key_elbow_neg = FALSE;
-static gboolean key_wrist_pos = FALSE;
-static gboolean key_wrist_neg = FALSE;
-static gboolean key_claw_pos = FALSE;
-static gboolean key_claw_neg = FALSE;
+static atomic_bool keyboard_enabled = TRUE;
+static atomic_bool joystick_enabled = TRUE;
+
+//which keys are held and where the pad was left, see arm_input.c
+static struct keyboard_input keyboard_input;
+static struct joystick_input joystick_input;
+static struct input_map input_map;  // input_map_default, or --input-map
 
 //status labels
 GtkWidget *battery_status_label;
@@ -46,112 +46,95 @@ GtkWidget *command_status_label;
 //initialising statuses
 int battery_status = 0;
 
-void read_robot_status() {
-
-    char buffer[512];
-
-    const int fd = open(DEVICE_PATH, O_RDONLY);  // Open device file for writing
-    if (fd == -1) {
-        perror("Error opening device file");
-        return;
-    }
+//the arm (or the mock arm with --mock), opened in main()
+static struct arm_controller *arm;
 
-    const ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-    if (bytes_read == -1) {
-        perror("Error reading from device file");
-        close(fd);
-        return;
-    }
-
-    buffer[bytes_read] = '\0';
+static const char *const connected_label_text[] = { "Arm status: Disconnected", "Arm status: Connected" };
+static const char *const command_label_text[] = {
+    [COMMAND_STATE_NONE] = "Command status: None",
+    [COMMAND_STATE_GOOD] = "Command status: Good",
+    [COMMAND_STATE_BAD] = "Command status: Bad",
+};
+static const char *const battery_label_text[BATTERY_MAX + 1] = {
+    "Battery: 0/4", "Battery: 1/4", "Battery: 2/4", "Battery: 3/4", "Battery: 4/4"
+};
 
-    //printf("%s", buffer);
+//what the labels currently show, matches the text they are created with in main()
+static struct robot_status shown_status = { .connected = false, .command = COMMAND_STATE_NONE, .battery = 0 };
 
-    char connected[4];
-    char status[4];
-    char battery[2];
+//updates only the labels whose field changed (main loop only)
+static void apply_robot_status(const struct robot_status *status) {
 
-    if (sscanf(buffer, "connected:%4s status:%4s battery:%1s", connected, status, battery) != 3) {
-        close(fd);
-        return;
+    if (status->connected != shown_status.connected) {
+        shown_status.connected = status->connected;
+        gtk_label_set_text(GTK_LABEL(arm_connection_label), connected_label_text[status->connected]);
     }
 
-    close(fd);
-
-    // Actually convert String to int the proper way
-    const int battery_level = (int) strtol(battery, NULL, 10);
-
-    //printf("connected:%s status:%s battery:%d\n", connected, status, battery_level);
-
-    char *final_connected_string;  // Declare outside
-
-    if (strcmp(connected, "yes") == 0) {
-        final_connected_string = "Connected";
-    } else {
-        final_connected_string = "Disconnected";
+    if (status->command != shown_status.command) {
+        shown_status.command = status->command;
+        gtk_label_set_text(GTK_LABEL(command_status_label), command_label_text[status->command]);
     }
 
-    gtk_label_set_text(GTK_LABEL(arm_connection_label),
-        g_strdup_printf("Arm status: %s", final_connected_string));
-
-    char *final_Command_String;
-
-    if (strcmp(status, "good") == 0) {
-        final_Command_String = "Good";
-    } else if (strcmp(status, "bad") == 0) {
-        final_Command_String = "Bad";
-    } else {
-        final_Command_String = "None";
+    // Out of range readings leave the last good battery level on screen
+    if (status->battery >= 0 && status->battery != shown_status.battery) {
+        shown_status.battery = status->battery;
+        gtk_label_set_text(GTK_LABEL(battery_status_label), battery_label_text[status->battery]);
     }
-
-    gtk_label_set_text(GTK_LABEL(command_status_label),
-        g_strdup_printf("Command status: %s", final_Command_String));
-
-    if (battery_level < 5 && battery_level > -1) {
-        gtk_label_set_text(GTK_LABEL(battery_status_label),
-         g_strdup_printf("Battery: %d/4", battery_level));
-    }
-
 }
 
-/**
- * Sends a command to the A37JN robot arm via the device file.
- * @param command: The command string to send (e.g., "base:left\n").
- * @return 0 on success, -1 on failure.
+/*
+ * Reading handed over by the poller thread for the labels. The poller only
+ * calls in when something changed, and at most one idle callback is queued.
  */
+static struct {
+    struct robot_status status;
+    bool pending;
+    pthread_mutex_t lock;
+} posted_status = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+//runs on the main loop with whatever status the poller read last
+static gboolean apply_latest_status(gpointer data) {
+
+    pthread_mutex_lock(&posted_status.lock);
+    const struct robot_status status = posted_status.status;
+    posted_status.pending = false;
+    pthread_mutex_unlock(&posted_status.lock);
+
+    apply_robot_status(&status);
+    return G_SOURCE_REMOVE;
+}
 
-int send_robot_command(const char *command) {
+//controller callback on the poller thread, passes the reading on to the main loop
+static void post_robot_status(const struct robot_status *status, void *data) {
+    pthread_mutex_lock(&posted_status.lock);
+    posted_status.status = *status;
+    if (!posted_status.pending) {
+        posted_status.pending = true;
+        g_idle_add(apply_latest_status, NULL);
+    }
+    pthread_mutex_unlock(&posted_status.lock);
+}
 
-    printf("Sending command: %s\n", command);
+//runs on the main loop, the writer thread can't touch GTK widgets itself
+static gboolean show_command_failed(gpointer data) {
+    shown_status.command = COMMAND_STATE_BAD;
+    gtk_label_set_text(GTK_LABEL(command_status_label), command_label_text[COMMAND_STATE_BAD]);
 
-    const int fd = open(DEVICE_PATH, O_WRONLY);  // Open device file for writing
-    if (fd < 0) {
-        perror("Error opening device file");
-        return -1;
-    }
-    const ssize_t bytes_written = write(fd, command, strlen(command));
-    if (bytes_written == -1) {
-        perror("Error writing to device file");
-        close(fd);
-        return -1;
-    }
-    read_robot_status();
-    close(fd);
-    return 0;
+    // The label no longer matches what the poller last posted, make it post the next reading
+    arm_controller_forget_status(arm);
+    return G_SOURCE_REMOVE;
 }
 
-struct device_command {
-    int var1;
-    int var2;
-    int var3;
-};
+//controller callback for a refused ioctl, runs on the writer thread
+static void post_command_failed(void *data) {
+    g_idle_add(show_command_failed, NULL);
+}
 
 //direct command input (ioctl)
 static void on_text_entry_submit(GtkWidget *widget, gpointer data) {
 
     GtkWidget *entry = GTK_WIDGET(data);
     const gchar *input = gtk_entry_get_text(GTK_ENTRY(entry));
-    printf("Debugging: received input: %s\n", input);
 
     struct device_command cmd;
 
@@ -161,25 +144,13 @@ static void on_text_entry_submit(GtkWidget *widget, gpointer data) {
         return;
     }
 
-    const int fd = open(DEVICE_PATH, O_WRONLY);  // Open device file for writing
-    if (fd < 0) {
-        perror("Error opening device file");
-        return;
-    }
-
-    printf("Debugging: Sending command: %d,%d,%d\n", cmd.var1, cmd.var2, cmd.var3);
+    TRACE_DEBUG(TRACE_UI_RAW_ENTRY, cmd.var1, cmd.var2, cmd.var3);
 
-    if (ioctl(fd, IOCTL_SET_VALUE, &cmd) == -1) {
-        perror("ioctl failed");
-        gtk_label_set_text(GTK_LABEL(command_status_label),"Command status: Bad");
-        close(fd);
+    if (arm_send_raw(arm, &cmd) == -1) {
+        show_command_failed(NULL);
         return;
     }
 
-    printf("Sent ioctl command: var1=%d, var2=%d, var3=%d\n", cmd.var1, cmd.var2, cmd.var3);
-
-    close(fd);
-
     gtk_entry_set_text(GTK_ENTRY(entry), "");
 
 }
@@ -187,521 +158,295 @@ static void on_text_entry_submit(GtkWidget *widget, gpointer data) {
 //light (on, off)
 static void on_light_on_button_clicked(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("led:on");
-    printf("Debugging: light on\n");
+    arm_send_joint(arm, JOINT_LED, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_LED, JOINT_POS);
 }
 static void on_light_off_button_clicked(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("led:off");
-    printf("Debugging: light off\n");
+    arm_send_joint(arm, JOINT_LED, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_LED, JOINT_STOP);
 }
 
 //base (clockwise = +, anticlockwise = -)
 static void on_base_pos_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("base:right");
-    printf("Debugging: base turning clockwise\n");
+    arm_send_joint(arm, JOINT_BASE, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_BASE, JOINT_POS);
 }
 static void on_base_neg_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("base:left");
-    printf("Debugging: base turning anticlockwise\n");
+    arm_send_joint(arm, JOINT_BASE, JOINT_NEG);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_BASE, JOINT_NEG);
 }
 static void on_base_button_released(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("base:stop");
-    printf("Debugging: base turning stopped\n");
+    arm_send_joint(arm, JOINT_BASE, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_BASE, JOINT_STOP);
 }
 
 
 //shoulder
 static void on_shoulder_pos_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("shoulder:up");
-    printf("Debugging: shoulder opening\n");
+    arm_send_joint(arm, JOINT_SHOULDER, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_SHOULDER, JOINT_POS);
 }
 static void on_shoulder_neg_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("shoulder:down");
-    printf("Debugging: shoulder closing\n");
+    arm_send_joint(arm, JOINT_SHOULDER, JOINT_NEG);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_SHOULDER, JOINT_NEG);
 }
 static void on_shoulder_button_released(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("shoulder:stop");
-    printf("Debugging: shoulder turning stopped\n");
+    arm_send_joint(arm, JOINT_SHOULDER, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_SHOULDER, JOINT_STOP);
 }
 
 
 //elbow
 static void on_elbow_pos_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("elbow:up");
-    printf("Debugging: elbow opening\n");
+    arm_send_joint(arm, JOINT_ELBOW, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_ELBOW, JOINT_POS);
 }
 static void on_elbow_neg_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("elbow:down");
-    printf("Debugging: elbow closing\n");
+    arm_send_joint(arm, JOINT_ELBOW, JOINT_NEG);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_ELBOW, JOINT_NEG);
 }
 static void on_elbow_button_released(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("elbow:stop");
-    printf("Debugging: elbow turning stopped\n");
+    arm_send_joint(arm, JOINT_ELBOW, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_ELBOW, JOINT_STOP);
 }
 
 //wrist 
 static void on_wrist_pos_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("wrist:up");
-    printf("Debugging: wrist opening\n");
+    arm_send_joint(arm, JOINT_WRIST, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_WRIST, JOINT_POS);
 }
 static void on_wrist_neg_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("wrist:down");
-    printf("Debugging: wrist closing\n");
+    arm_send_joint(arm, JOINT_WRIST, JOINT_NEG);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_WRIST, JOINT_NEG);
 }
 static void on_wrist_button_released(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("wrist:stop");
-    printf("Debugging: wrist turning stopped\n");
+    arm_send_joint(arm, JOINT_WRIST, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_WRIST, JOINT_STOP);
 }
 
 //claw (open = +, close = -)
 static void on_claw_pos_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("claw:open");
-    printf("Debugging: claw opening\n");
+    arm_send_joint(arm, JOINT_CLAW, JOINT_POS);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_CLAW, JOINT_POS);
 }
 static void on_claw_neg_button_pressed(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("claw:close");
-    printf("Debugging: claw closing\n");
+    arm_send_joint(arm, JOINT_CLAW, JOINT_NEG);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_CLAW, JOINT_NEG);
 }
 static void on_claw_button_released(GtkWidget *widget, gpointer data) {
     //call to device
-    send_robot_command("claw:stop");
-    printf("Debugging: claw stopped\n");
+    arm_send_joint(arm, JOINT_CLAW, JOINT_STOP);
+    TRACE_DEBUG(TRACE_UI_BUTTON, JOINT_CLAW, JOINT_STOP);
 }
 
 //key press event callback
 static gboolean on_key_press(GtkWidget *widget, const GdkEventKey *event, gpointer data) {
 
-    if (active_input_mode != 1) return FALSE;
+    // The E-stop works whatever the input mode and whatever has focus, and isn't passed on
+    if (keyboard_input_emergency(&keyboard_input, event->keyval)) {
+        latency_mark_input();
+        arm_emergency_stop(arm);
+        latency_clear_input();
+        return TRUE;
+    }
+
+    if (atomic_load(&active_input_mode) != 1) return FALSE;
 
     //checking keyboard input selected
-    if (!keyboard_enabled) {
+    if (!atomic_load(&keyboard_enabled)) {
         return FALSE;
     }
 
-    switch (event->keyval) {
-
-        case GDK_KEY_1:
-            if(!key_light_on) {
-                key_light_on = TRUE;
-                on_light_on_button_clicked(widget, data);
-            }
-            break;
-
-        case GDK_KEY_2:
-            if(!key_light_off) {
-                key_light_off = TRUE;
-                on_light_off_button_clicked(widget, data);
-            }
-            break;
-
-        case GDK_KEY_k:
-            if(!key_base_pos) {
-                key_base_pos = TRUE;
-                on_base_pos_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_o:
-            if(!key_base_neg) {
-                key_base_neg = TRUE;
-                on_base_neg_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_j:
-            if(!key_shoulder_pos) {
-                key_shoulder_pos = TRUE;
-                on_shoulder_pos_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_i:
-            if(!key_shoulder_neg) {
-                key_shoulder_neg = TRUE;
-                on_shoulder_neg_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_f:
-            if(!key_elbow_pos) {
-                key_elbow_pos = TRUE;
-                on_elbow_pos_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_r:
-            if(!key_elbow_neg) {
-                key_elbow_neg = TRUE;
-                on_elbow_neg_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_d:
-            if(!key_wrist_pos) {
-                key_wrist_pos = TRUE;
-                on_wrist_pos_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_e:
-            if(!key_wrist_neg) {
-                key_wrist_neg = TRUE;
-                on_wrist_neg_button_pressed(widget, data);
-            }
-            break;
+    latency_mark_input();
 
-        case GDK_KEY_s:
-            if(!key_claw_pos) {
-                key_claw_pos = TRUE;
-                on_claw_pos_button_pressed(widget, data);
-            }
-            break;
-
-        case GDK_KEY_w:
-            if(!key_claw_neg) {
-                key_claw_neg = TRUE;
-                on_claw_neg_button_pressed(widget, data);
-            }
-            break;
-
-        default:
-            break;
-    }
+    keyboard_input_press(&keyboard_input, event->keyval, arm);
+    latency_clear_input();
     return FALSE;
 }
 
 //key release 
 static void on_key_release(GtkWidget *widget, const GdkEventKey *event, gpointer data) {
 
-    if (active_input_mode != 1) return;
-
-    switch (event->keyval) {
-        case GDK_KEY_1:
-            key_light_on = FALSE;
-            break;
-
-        case GDK_KEY_2:
-            key_light_off = FALSE;
-            break;
+    if (atomic_load(&active_input_mode) != 1) return;
 
-        case GDK_KEY_k:
-            if(key_base_pos) {
-                on_base_button_released(widget, data);
-                key_base_pos = FALSE;
-            }
-            break;
+    latency_mark_input();
 
-        case GDK_KEY_o:
-            if(key_base_neg) {
-                on_base_button_released(widget, data);
-                key_base_neg = FALSE;
-            }
-            break;
-
-        case GDK_KEY_j:
-            if(key_shoulder_pos) {
-                on_shoulder_button_released(widget, data);
-                key_shoulder_pos = FALSE;
-            }
-            break;
+    keyboard_input_release(&keyboard_input, event->keyval, arm);
+    latency_clear_input();
+}
 
-        case GDK_KEY_i:
-            if(key_shoulder_neg) {
-                on_shoulder_button_released(widget, data);
-                key_shoulder_neg = FALSE;
-            }
-            break;
+/*
+ * The joystick thread sleeps in poll() until something happens: an event from
+ * the pad, a mode change or shutdown (joystick_wake_fd), or the pad's device
+ * node appearing/disappearing under /dev/input (inotify). Nothing runs while idle,
+ * except with --watchdog, when it wakes now and then to say the pad is still read.
+ */
+static int joystick_wake_fd = -1;
 
-        case GDK_KEY_f:
-            if(key_elbow_pos) {
-                on_elbow_button_released(widget, data);
-                key_elbow_pos = FALSE;
-            }
-            break;
+//wakes joystick_listener so it re-reads the input mode and joystick_enabled
+static void joystick_listener_wake(void) {
+    const uint64_t one = 1;
+    if (joystick_wake_fd >= 0 && write(joystick_wake_fd, &one, sizeof(one)) == -1) {
+        perror("Error waking joystick thread");
+    }
+}
 
-        case GDK_KEY_r:
-            if(key_elbow_neg) {
-                on_elbow_button_released(widget, data);
-                key_elbow_neg = FALSE;
-            }
-            break;
+struct label_update {
+    GtkWidget *label;
+    const char *text;  // must be a string literal, it is read later on the main loop
+};
 
-        case GDK_KEY_d:
-            if(key_wrist_pos) {
-                on_wrist_button_released(widget, data);
-                key_wrist_pos = FALSE;
-            }
-            break;
+static gboolean apply_label_update(gpointer data) {
+    struct label_update *update = data;
+    gtk_label_set_text(GTK_LABEL(update->label), update->text);
+    g_free(update);
+    return G_SOURCE_REMOVE;
+}
 
-        case GDK_KEY_e:
-            if(key_wrist_neg) {
-                on_wrist_button_released(widget, data);
-                key_wrist_neg = FALSE;
-            }
-            break;
+//sets a label from a thread other than the GTK one by handing it to the main loop
+static void post_label_text(GtkWidget *label, const char *text) {
+    struct label_update *update = g_malloc(sizeof(*update));
+    update->label = label;
+    update->text = text;
+    g_idle_add(apply_label_update, update);
+}
 
-        case GDK_KEY_s:
-            if(key_claw_pos) {
-                on_claw_button_released(widget, data);
-                key_claw_pos = FALSE;
-            }
-            break;
+static int joystick_open(void) {
+    const int fd = open(JOYSTICK_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd >= 0) {
+        post_label_text(joystick_connection_label, "Joystick status: Connected");
+        printf("Joystick monitoring started on %s\n", JOYSTICK_DEV);
+    }
+    return fd;
+}
 
-        case GDK_KEY_w:
-            if(key_claw_neg) {
-                on_claw_button_released(widget, data);
-                key_claw_neg = FALSE;
-            }
-            break;
+static void joystick_close(int *fd) {
+    close(*fd);
+    *fd = -1;
+    post_label_text(joystick_connection_label, "Joystick status: Disconnected");
+    printf("Waiting for joystick to be reconnected...\n");
+}
 
-        default:
-            break;
+//true if the inotify events just read mention our joystick's device node
+static bool joystick_node_changed(const char *buffer, ssize_t len, const char *name) {
+    for (ssize_t offset = 0; offset < len; ) {
+        const struct inotify_event *event = (const struct inotify_event *) (buffer + offset);
+        if (event->len > 0 && strcmp(event->name, name) == 0) {
+            return true;
+        }
+        offset += sizeof(struct inotify_event) + event->len;
     }
+    return false;
 }
 
 void* joystick_listener(void *arg) {
 
-    int fd = open(JOYSTICK_DEV, O_RDONLY);
+    arm_controller_bind_source(arm, SOURCE_JOYSTICK);
+
+    const char *slash = strrchr(JOYSTICK_DEV, '/');
+    const char *node_name = slash + 1;
+    char node_dir[64];
+    snprintf(node_dir, sizeof(node_dir), "%.*s", (int) (slash - JOYSTICK_DEV), JOYSTICK_DEV);
+
+    // Hotplug: udev creates the node and then fixes its permissions, so watch both
+    const int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, node_dir, IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+        perror("Error watching for joystick hotplug");
+    }
 
+    int fd = joystick_open();
     if (fd < 0) {
         perror("Error opening joystick");
-        gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Disconnected");
+        post_label_text(joystick_connection_label, "Joystick status: Disconnected");
         printf("Attempting to connect to joystick...\n");
-
-        // Always tries to detect the Joystick
-        while (fd < 0) {
-            usleep(10000);
-            fd = open(JOYSTICK_DEV, O_RDONLY);
-        }
     }
 
-    // UI showing the Joystick is connected
-    gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Connected");
-
-    struct js_event js;
-    printf("Joystick monitoring started on %s\n", JOYSTICK_DEV);
-        
-    // Initalising the states for all the axis motors
-    static int last_wrist_state = 0;
-    static int last_shoulder_state = 0;
-    static int last_rotate_state = 0;
-    static int last_elbow_state = 0;
-    static int last_claw_state = 0;
+    while (atomic_load(&joystick_enabled)) {
 
-while (joystick_enabled) {
+        // Only listen to the pad while it's the selected input, otherwise just wait for a mode change
+        const bool listening = fd >= 0 && atomic_load(&active_input_mode) == 2;
+        struct pollfd fds[3] = {
+            { .fd = joystick_wake_fd, .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN },
+            { .fd = listening ? fd : -1, .events = POLLIN },
+        };
 
-        if (active_input_mode != 2) {
-            usleep(10000);
-            continue;
+        // Wakes for the watchdog too, so the pad's joints are only kept alive while it is being read
+        if (listening) {
+            arm_controller_heartbeat(arm);
+        }
+        if (poll(fds, 3, listening ? arm_controller_heartbeat_ms(arm) : -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("Joystick poll failed");
+            break;
         }
 
-        if (read(fd, &js, sizeof(struct js_event)) != sizeof(struct js_event)) {
-
-            gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Disconnected");
-            printf("Attempting to reconnect to joystick...\n");
-
-            // Wait for joystick to be reconnected
-            close(fd);
-            fd = -1;
-
-            // Will keep trying to detect Joystick
-            while (fd < 0) {
-                usleep(10000);
-                fd = open(JOYSTICK_DEV, O_RDONLY);
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(joystick_wake_fd, &count, sizeof(count)) == -1) {
+                perror("Error reading joystick wake event");
             }
-
-            gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Connected");
-            continue;
-
         }
 
-        if(js.type == JS_EVENT_BUTTON) { 
-            if(js.value == 1) { 
-                switch (js.number) {
-                    case 0:
-                        if (last_claw_state != -1) {
-                            send_robot_command("claw:close");
-                            printf("Claw Close\n");
-                            last_claw_state = -1;
-                        }
-                        break;
-        
-                    case 1:
-                        if (last_claw_state != 1) {
-                            send_robot_command("claw:open");
-                            last_claw_state = 1;
-                            printf("Claw opening\n");
-                        }
-                        break;
-        
-                    case 2:
-                        if(last_wrist_state != -1) {
-                            send_robot_command("wrist:down");
-                            last_wrist_state = -1;
-                            printf("Debugging: wrist down\n");
-                        }
-                        break;
-        
-                    case 3:
-                        send_robot_command("led:off");
-                        printf("Joystick: Lights off\n");
-                        break;
-        
-                    case 4:
-                        if(last_wrist_state != 1) {
-                            send_robot_command("wrist:up");
-                            last_wrist_state = 1;
-                            printf("Debugging: wrist up\n");
-                        }
-                        break;
-        
-                    case 5:
-                        send_robot_command("led:on");
-                        printf("Joystick: Lights on\n");
-                        break;
-        
-                    default:
-                        printf("Joystick Button %d pressed\n", js.number);
-                        break;
-                }
-
-            } else if(js.value == 0) { // Button released
-                switch (js.number) {
-
-                    // Two cases to handle both buttons being released
-                    case 0:
-                    case 1:
-                        if (last_claw_state != 0) {
-                            send_robot_command("claw:stop");
-                            last_claw_state = 0;
-                            printf("Claw stopped\n");
-                        }
-                        break;
-
-                    case 2: // Wrist down button released
-                    case 4: // Wrist up button released
-                        if(last_wrist_state != 0) {
-                            send_robot_command("wrist:stop");
-                            last_wrist_state = 0;
-                            printf("Debugging: wrist stopped\n");
-                        }
-                        break;
-
-                    default:
-                        printf("Joystick Button %d released\n", js.number);
-                        break;
+        if (fds[1].revents & POLLIN) {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            const ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+            if (len > 0 && joystick_node_changed(buffer, len, node_name)) {
+                if (fd >= 0 && access(JOYSTICK_DEV, F_OK) != 0) {
+                    joystick_close(&fd);
+                } else if (fd < 0) {
+                    fd = joystick_open();
                 }
             }
         }
 
-        if(js.type == JS_EVENT_AXIS) {
-
-            const int dead_zone = 10000;
-
-            switch(js.number) {
-                case 1: { // Shoulder tilt (forward/backward)
-                    int new_state;
-        
-                    if(js.value >= dead_zone) {
-                        new_state = 1; // Moving up
-                    } else if(js.value <= -dead_zone) {
-                        new_state = -1; // Moving down
-                    } else {
-                        new_state = 0; // Stopped
-                    }
-        
-                    if(new_state != last_shoulder_state) {
-                        last_shoulder_state = new_state;
-                        if(new_state == 1) {
-                            send_robot_command("shoulder:up");
-                            printf("Axis 1: Shoulder UP\n");
-                        } else if(new_state == -1) {
-                            send_robot_command("shoulder:down");
-                            printf("Axis 1: Shoulder DOWN\n");
-                        } else {
-                            send_robot_command("shoulder:stop");
-                            printf("Axis 1: Shoulder stopped\n");
-                        }
-                    }
-                    break;
-                }
-                case 3: { // Base logic (left/right)
-                    int new_state;
-
-                    // Extra dead-zone for the base as it's needed
-                    if(js.value >= (dead_zone + 10000*2 )) {
-                        new_state = 1; // Turning Left
-                    } else if(js.value <= -(dead_zone + 10000 )) {
-                        new_state = -1; // Turning Right
-                    } else {
-                        new_state = 0; // Stopped
-                    }
-        
-                    if(new_state != last_rotate_state) {
-                        last_rotate_state = new_state;
-                        if(new_state == 1) {
-                            send_robot_command("base:right");
-                            printf("Axis 3: Positive\n");
-                        } else if(new_state == -1) {
-                            send_robot_command("base:left");
-                            printf("Axis 3: Negative\n");
-                        } else {
-                            send_robot_command("base:stop");
-                            printf("Axis 3: stopped\n");
-                        }
-                    }
-                    break;
-                }
-                case 5: { // Wrist Logic
-                    int new_state;
-        
-                    if(js.value >= dead_zone) {
-                        new_state = 1; // Moving up
-                    } else if(js.value <= -dead_zone) {
-                        new_state = -1; // Moving down
-                    } else {
-                        new_state = 0; // Stopped
-                    }
-        
-                    if(new_state != last_elbow_state) {
-                        last_elbow_state = new_state;
-                        if(new_state == 1) {
-                            send_robot_command("elbow:down");
-                            printf("Axis 4: Positive\n");
-                        } else if(new_state == -1) {
-                            send_robot_command("elbow:up");
-                            printf("Axis 4: Negative\n");
-                        } else {
-                            send_robot_command("elbow:stop");
-                            printf("Axis 4: stopped\n");
-                        }   
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
+        if (fds[2].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            joystick_close(&fd);
+            continue;
+        }
+
+        if ((fds[2].revents & POLLIN) && !joystick_input_drain(&joystick_input, fd, arm)) {
+            joystick_close(&fd);
         }
     }
-    close(fd);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
     return NULL;
 }
 
+//the main loop is still turning, see --watchdog
+static gboolean on_heartbeat(gpointer data) {
+    arm_controller_heartbeat(arm);
+    return G_SOURCE_CONTINUE;
+}
+
+//SIGUSR1: print the latency histograms without stopping
+static gboolean on_latency_dump_signal(gpointer data) {
+    latency_dump(stdout);
+    fflush(stdout);
+    return G_SOURCE_CONTINUE;
+}
+
 //isolating input radio button methods
 static void toggle_buttons(gboolean enable) {
     GList *i;
@@ -712,24 +457,27 @@ static void toggle_buttons(gboolean enable) {
 
 static void on_mouse_toggle_clicked(GtkWidget *widget, gpointer data) {
     if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
-        active_input_mode = 0;
-        keyboard_enabled = FALSE;
+        atomic_store(&active_input_mode, 0);
+        joystick_listener_wake();
+        atomic_store(&keyboard_enabled, FALSE);
         toggle_buttons(TRUE);
     }
 }
 
 static void on_keyboard_toggle_clicked(GtkWidget *widget, gpointer data) {
     if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
-        active_input_mode = 1;
-        keyboard_enabled = TRUE;
+        atomic_store(&active_input_mode, 1);
+        joystick_listener_wake();
+        atomic_store(&keyboard_enabled, TRUE);
         toggle_buttons(FALSE);
     }
 }
 
 static void on_joystick_toggle_clicked(GtkWidget *widget, gpointer data) {
     if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget))) {
-        active_input_mode = 2;
-        keyboard_enabled = FALSE;
+        atomic_store(&active_input_mode, 2);
+        joystick_listener_wake();
+        atomic_store(&keyboard_enabled, FALSE);
         toggle_buttons(FALSE);
 
     }
@@ -739,6 +487,41 @@ int main(int argc, char *argv[])
 {
     gtk_init(&argc, &argv); //initialising gtk - the gui lib i'm using
 
+    struct arm_options options = ARM_OPTIONS_DEFAULT;
+    options.on_status = post_robot_status;
+    options.on_command_failed = post_command_failed;
+
+    bool map_loaded = false;
+
+    // gtk_init leaves only our own arguments behind
+    for (int i = 1; i < argc; i++) {
+        const int parsed = arm_options_parse_arg(&options, argv[i]);
+        if (parsed < 0) {
+            return 1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "--input-map=", strlen("--input-map=")) == 0) {
+            if (input_map_load(&input_map, argv[i] + strlen("--input-map=")) != 0) {
+                return 1;
+            }
+            map_loaded = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else {
+            fprintf(stderr, "Usage: %s " ARM_OPTIONS_USAGE " [--input-map=FILE] [--verbose]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!map_loaded && input_map_load_default(&input_map) != 0) {
+        return 1;
+    }
+    keyboard_input.map = &input_map;
+    joystick_input.map = &input_map;
+
+    g_unix_signal_add(SIGUSR1, on_latency_dump_signal, NULL);
+
     GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL); //instantiating a window, TOPLEVEL allows window title etc
     gtk_window_set_title(GTK_WINDOW(window), "Robotic Arm Controller"); //window title
     gtk_container_set_border_width(GTK_CONTAINER(window), 20); //window border width size
@@ -967,28 +750,49 @@ int main(int argc, char *argv[])
     gtk_widget_set_halign(battery_status_label, GTK_ALIGN_START);
     gtk_widget_set_margin_bottom(battery_status_label, 10);
 
+    // Start the device writer before anything can queue commands, this thread queues for the UI
+    arm = arm_controller_open(&options);
+    if (arm == NULL) {
+        return 1;
+    }
+    arm_controller_bind_source(arm, SOURCE_UI);
+    if (arm_controller_heartbeat_ms(arm) > 0) {
+        g_timeout_add(arm_controller_heartbeat_ms(arm), on_heartbeat, NULL);
+    }
+
     // Declare a thread variable for the joystick listener
     pthread_t joystick_thread;
+    bool joystick_thread_started = false;
+
+    joystick_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
     // Attempt to create a new thread
-    if (pthread_create(&joystick_thread, NULL, joystick_listener, NULL) != 0) {
+    if (joystick_wake_fd < 0 || pthread_create(&joystick_thread, NULL, joystick_listener, NULL) != 0) {
         // If thread creation fails, print an error message
         perror("Failed to create joystick thread");
 
          // Update the GTK label to indicate the joystick connection failed
         gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Failed");
     } else {
-        // If the thread is successfully created, update the label to show connection success
-        gtk_label_set_text(GTK_LABEL(joystick_connection_label), "Joystick status: Connected");
+        joystick_thread_started = true;
     }
 
     gtk_widget_show_all(window);
 
     // Send this to make sure arm is not moving and to show connection status
-    send_robot_command("stop:all");
+    arm_send_stop_all(arm);
     gtk_label_set_text(GTK_LABEL(command_status_label),"Command status: None");
 
     gtk_main();
 
+    // Stop the joystick first so it can't queue anything after the writer has drained
+    atomic_store(&joystick_enabled, FALSE);
+    if (joystick_thread_started) {
+        joystick_listener_wake();
+        pthread_join(joystick_thread, NULL);
+    }
+
+    arm_controller_close(arm, stdout);
+
     return 0;
 }
@@ -0,0 +1,184 @@
+/*
+ * Command path benchmark. Drives the dispatcher against the mock arm at a
+ * fixed command rate (or as fast as the queue takes them) and reports the
+ * throughput and the latency percentiles of every stage. --stop-every mixes in
+ * stop:all through the stop lane, to measure how long a stop waits behind a
+ * busy queue.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_dispatcher.h"
+#include "arm_latency.h"
+#include "arm_status.h"
+#include "arm_time.h"
+#include "mock_arm.h"
+
+#define BENCH_DEFAULT_RATE 1000
+#define BENCH_DEFAULT_COUNT 5000
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--text | --ioctl] [--rate=CMDS_PER_SEC] [--count=N] [--tick=HZ]"
+                    " [--stop-every=N] [--limit=HZ[,JOINT_HZ[,BURST]]] [--mock=DELAY_US[,FAIL_EVERY[,JITTER_US[,BATTERY]]]]\n", argv0);
+}
+
+//a whole decimal number after an option's '=', nothing after it
+static int parse_number(const char *text, unsigned long *value) {
+    char *end;
+    *value = strtoul(text, &end, 10);
+    return end != text && *end == '\0' ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct dispatcher_config config = { .transport = TRANSPORT_TEXT, .limit = RATE_LIMIT_CONFIG_DEFAULT };
+    struct mock_arm_config mock_config = MOCK_ARM_CONFIG_DEFAULT;
+    unsigned long rate = BENCH_DEFAULT_RATE;  // commands per second, 0 = as fast as the queue accepts them
+    unsigned long count = BENCH_DEFAULT_COUNT;
+    unsigned long stop_every = 0;  // every Nth command is a stop:all instead, 0 = none
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ioctl") == 0) {
+            config.transport = TRANSPORT_IOCTL;
+        } else if (strcmp(argv[i], "--text") == 0) {
+            config.transport = TRANSPORT_TEXT;
+        } else if (strncmp(argv[i], "--rate=", strlen("--rate=")) == 0) {
+            if (parse_number(argv[i] + strlen("--rate="), &rate) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--count=", strlen("--count=")) == 0) {
+            if (parse_number(argv[i] + strlen("--count="), &count) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--tick=", strlen("--tick=")) == 0) {
+            unsigned long tick_hz;
+            if (parse_number(argv[i] + strlen("--tick="), &tick_hz) != 0
+                    || tick_hz < CONTROL_RATE_MIN_HZ || tick_hz > CONTROL_RATE_MAX_HZ) {
+                fprintf(stderr, "--tick must be between %d and %d Hz\n", CONTROL_RATE_MIN_HZ, CONTROL_RATE_MAX_HZ);
+                return 1;
+            }
+            config.rate_hz = (unsigned int) tick_hz;
+        } else if (strncmp(argv[i], "--stop-every=", strlen("--stop-every=")) == 0) {
+            if (parse_number(argv[i] + strlen("--stop-every="), &stop_every) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--limit=", strlen("--limit=")) == 0) {
+            if (rate_limit_parse_config(argv[i] + strlen("--limit="), &config.limit) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--mock=", strlen("--mock=")) == 0) {
+            if (mock_arm_parse_config(argv[i] + strlen("--mock="), &mock_config) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    struct mock_arm mock;
+    mock_arm_init(&mock, &mock_config);
+
+    static struct device_session session = DEVICE_SESSION_INIT;
+    device_session_use(&session, &mock_arm_ops, &mock);
+
+    static struct status_poller poller = STATUS_POLLER_INIT;
+    static struct command_dispatcher dispatcher = COMMAND_DISPATCHER_INIT;
+    config.poller = &poller;
+
+    command_dispatcher_bind_producer(&dispatcher, SOURCE_UI);
+    if (status_poller_start(&poller, &session, NULL, NULL) != 0 ||
+            command_dispatcher_start(&dispatcher, &session, &config) != 0) {
+        perror("Failed to start benchmark threads");
+        return 1;
+    }
+
+    // Walk every joint through pos/neg/stop so each command changes the frame
+    static const enum joint_direction steps[] = { JOINT_POS, JOINT_NEG, JOINT_STOP };
+    const long long period_ns = rate > 0 ? 1000000000LL / (long long) rate : 0;
+    unsigned long sent = 0;
+    unsigned long refused = 0;
+    unsigned long stops = 0;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    const long long start_ns = timespec_ns(&next);
+
+    for (unsigned long i = 0; i < count; i++) {
+        const struct queued_command cmd = {
+            .kind = COMMAND_JOINT,
+            .joint = (enum joint) (i / 3 % JOINT_COUNT),
+            .direction = steps[i % 3],
+        };
+
+        if (period_ns > 0) {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            }
+            timespec_add_ns(&next, period_ns);
+        }
+        if (stop_every > 0 && i % stop_every == stop_every - 1) {
+            command_dispatcher_request_stop(&dispatcher, STOP_LANE_ALL);
+            stops++;
+            continue;
+        }
+
+        if (period_ns > 0) {
+            // At a fixed rate a full queue is a dropped command, like it would be for a real input
+            if (command_dispatcher_enqueue(&dispatcher, &cmd) == 0) {
+                sent++;
+            } else {
+                refused++;
+            }
+        } else {
+            while (command_dispatcher_enqueue(&dispatcher, &cmd) != 0) {
+                refused++;
+                sched_yield();
+            }
+            sent++;
+        }
+    }
+
+    command_dispatcher_stop(&dispatcher);
+    const double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+    status_poller_stop(&poller);
+    device_session_close(&session);
+
+    struct dispatcher_stats stats;
+    struct mock_arm_stats device;
+    command_dispatcher_get_stats(&dispatcher, &stats);
+    mock_arm_get_stats(&mock, &device);
+    mock_arm_destroy(&mock);
+
+    printf("Transport %s, %s, mock delay %u us (+%u jitter), failing every %u calls\n",
+           config.transport == TRANSPORT_IOCTL ? "ioctl" : "text",
+           config.rate_hz > 0 ? "tick-driven writer" : "event-driven writer",
+           mock_config.delay_us, mock_config.jitter_us, mock_config.fail_every);
+    if (rate > 0) {
+        printf("Sent %lu commands in %.3f s: %.0f commands/s (target %lu/s), %lu refused by a full queue\n",
+               sent, elapsed_s, sent / elapsed_s, rate, refused);
+    } else {
+        printf("Sent %lu commands in %.3f s: %.0f commands/s (unthrottled), waited on a full queue %lu times\n",
+               sent, elapsed_s, sent / elapsed_s, refused);
+    }
+    printf("Writer: %lu written (%lu coalesced), %lu dropped, max depth %u/%d\n",
+           stats.written, stats.coalesced, stats.dropped, stats.max_depth, COMMAND_QUEUE_SIZE);
+    if (stop_every > 0) {
+        printf("Stop lane: %lu stop:all asked for, %lu sent, %lu queued moves cancelled\n",
+               stops, stats.stops, stats.cancelled);
+    }
+    if (config.limit.link_hz > 0) {
+        printf("Limiter at %u calls/s, %u changes/s per joint: %lu merged, %lu delayed, %lu rejected\n",
+               config.limit.link_hz, config.limit.joint_hz, stats.merged, stats.delayed, stats.rejected);
+    }
+    printf("Device: %lu writes, %lu ioctls, %lu status reads, %lu injected failures, %lu rejected\n",
+           device.writes, device.ioctls, device.reads, device.failures, device.rejected);
+    latency_dump(stdout);
+    return 0;
+}
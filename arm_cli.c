@@ -0,0 +1,241 @@
+/*
+ * Headless front end: drives the arm from commands on stdin (and optionally
+ * a joystick) through the same core as the GTK app, for machines with no
+ * display or no GTK at all.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arm_control.h"
+#include "arm_input.h"
+#include "arm_joyfeed.h"
+#include "arm_latency.h"
+
+#define CLI_LINE_MAX 256
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void on_quit_signal(int sig) {
+    quit_requested = 1;
+}
+
+static const char *const command_state_text[] = {
+    [COMMAND_STATE_NONE] = "none",
+    [COMMAND_STATE_GOOD] = "good",
+    [COMMAND_STATE_BAD] = "bad",
+};
+
+static void print_status(const struct robot_status *status) {
+    printf("Status: connected=%s command=%s battery=%d/%d\n", status->connected ? "yes" : "no",
+           command_state_text[status->command], status->battery, BATTERY_MAX);
+    fflush(stdout);
+}
+
+//controller callback, runs on the poller thread
+static void on_status(const struct robot_status *status, void *data) {
+    print_status(status);
+}
+
+static void on_command_failed(void *data) {
+    fprintf(stderr, "Command status: Bad\n");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s " ARM_OPTIONS_USAGE " [--joystick=PATH [--joystick-capture=FILE] | --joystick-feed=SPEC] [--input-map=FILE] [--verbose]\n"
+                    "Commands, one per line: JOINT:DIRECTION (e.g. shoulder:up), stop:all, estop,\n"
+                    "raw VAR1,VAR2,VAR3, status, stats, quit. Anything else is written to the arm as is.\n"
+                    "--joystick-feed plays a capture FILE, or synth[:RATE[,COUNT[,SEED]]], in place of a pad.\n", argv0);
+}
+
+/**
+ * Acts on one line from stdin.
+ * @return false once the user asked to quit.
+ */
+static bool handle_line(struct arm_controller *arm, char *line) {
+    line[strcspn(line, "\r\n")] = '\0';
+    enum joint joint;
+    enum joint_direction direction;
+    struct device_command frame;
+
+    if (line[0] == '\0') {
+        return true;
+    }
+    if (strcmp(line, "quit") == 0 || strcmp(line, "exit") == 0) {
+        return false;
+    }
+    if (strcmp(line, "stop:all") == 0 || strcmp(line, "stop") == 0) {
+        arm_send_stop_all(arm);
+    } else if (strcmp(line, "estop") == 0) {
+        arm_emergency_stop(arm);
+    } else if (parse_joint_command(line, strlen(line), &joint, &direction) == 0) {
+        arm_send_joint(arm, joint, direction);
+    } else if (sscanf(line, "raw %d,%d,%d", &frame.var1, &frame.var2, &frame.var3) == 3) {
+        arm_send_raw(arm, &frame);
+    } else if (strcmp(line, "status") == 0) {
+        struct robot_status status;
+        if (arm_controller_get_status(arm, &status)) {
+            print_status(&status);
+        } else {
+            printf("Status: no reading yet\n");
+        }
+    } else if (strcmp(line, "stats") == 0) {
+        struct dispatcher_stats stats;
+        arm_controller_get_stats(arm, &stats);
+        printf("Command queue: %lu queued, %lu written (%lu coalesced), %lu dropped, %lu overflowed, depth %u\n",
+               stats.enqueued, stats.written, stats.coalesced, stats.dropped, stats.overflows, stats.depth);
+        printf("Stop lane: %lu stops, %lu queued moves cancelled\n", stats.stops, stats.cancelled);
+        printf("Limiter: %lu merged, %lu delayed, %lu rejected\n", stats.merged, stats.delayed, stats.rejected);
+        latency_dump(stdout);
+    } else {
+        arm_send_text(arm, line);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    struct arm_options options = ARM_OPTIONS_DEFAULT;
+    options.on_status = on_status;
+    options.on_command_failed = on_command_failed;
+    const char *joystick_path = NULL;
+    const char *capture_path = NULL;
+    struct joystick_feed_config feed_config = JOYSTICK_FEED_CONFIG_DEFAULT;
+    bool feeding = false;
+    static struct input_map input_map;
+    bool map_loaded = false;
+
+    for (int i = 1; i < argc; i++) {
+        const int parsed = arm_options_parse_arg(&options, argv[i]);
+        if (parsed < 0) {
+            return 1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "--joystick=", strlen("--joystick=")) == 0) {
+            joystick_path = argv[i] + strlen("--joystick=");
+        } else if (strncmp(argv[i], "--joystick-capture=", strlen("--joystick-capture=")) == 0) {
+            capture_path = argv[i] + strlen("--joystick-capture=");
+        } else if (strncmp(argv[i], "--joystick-feed=", strlen("--joystick-feed=")) == 0) {
+            if (joystick_feed_parse(argv[i] + strlen("--joystick-feed="), &feed_config) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            feeding = true;
+        } else if (strncmp(argv[i], "--input-map=", strlen("--input-map=")) == 0) {
+            if (input_map_load(&input_map, argv[i] + strlen("--input-map=")) != 0) {
+                return 1;
+            }
+            map_loaded = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!map_loaded && input_map_load_default(&input_map) != 0) {
+        return 1;
+    }
+
+    // No SA_RESTART, so poll() returns and the loop sees the request
+    struct sigaction quit_action = { .sa_handler = on_quit_signal };
+    sigemptyset(&quit_action.sa_mask);
+    sigaction(SIGINT, &quit_action, NULL);
+    sigaction(SIGTERM, &quit_action, NULL);
+
+    struct arm_controller *arm = arm_controller_open(&options);
+    if (arm == NULL) {
+        return 1;
+    }
+    arm_controller_bind_source(arm, SOURCE_UI);
+
+    struct joystick_input pad = { .map = &input_map };
+    struct joystick_feed feed;
+    int joystick_fd = -1;
+    if (feeding) {
+        joystick_fd = joystick_feed_start(&feed, &feed_config);
+    } else if (joystick_path != NULL) {
+        joystick_fd = open(joystick_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (joystick_fd < 0) {
+            perror("Error opening joystick");
+        }
+        if (joystick_fd >= 0 && capture_path != NULL) {
+            pad.capture = fopen(capture_path, "wb");
+            if (pad.capture == NULL) {
+                perror("Error creating joystick capture");
+            }
+        }
+    }
+
+    // Make sure the arm isn't moving from a previous run
+    arm_send_stop_all(arm);
+
+    char line[CLI_LINE_MAX];
+    size_t used = 0;
+    bool running = true;
+
+    while (running && !quit_requested) {
+        struct pollfd fds[2] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = joystick_fd, .events = POLLIN },
+        };
+        arm_controller_heartbeat(arm);
+        if (poll(fds, 2, arm_controller_heartbeat_ms(arm)) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll failed");
+            break;
+        }
+
+        if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)
+                || ((fds[1].revents & POLLIN) && !joystick_input_drain(&pad, joystick_fd, arm))) {
+            fprintf(stderr, "Joystick disconnected\n");
+            close(joystick_fd);
+            joystick_fd = -1;
+            // The pad shares this thread's heartbeat with stdin, so the watchdog can't tell it went
+            arm_send_stop_all(arm);
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            const ssize_t bytes_read = read(STDIN_FILENO, line + used, sizeof(line) - 1 - used);
+            if (bytes_read < 0 && errno == EINTR) continue;
+            if (bytes_read <= 0) break;  // end of input
+            used += (size_t) bytes_read;
+            line[used] = '\0';
+
+            // Act on every complete line, keep the partial one for the next read
+            char *start = line;
+            char *newline;
+            while (running && (newline = strchr(start, '\n')) != NULL) {
+                *newline = '\0';
+                running = handle_line(arm, start);
+                start = newline + 1;
+            }
+            used = strlen(start);
+            memmove(line, start, used + 1);
+            if (used == sizeof(line) - 1) {
+                fprintf(stderr, "Line too long, ignored\n");
+                used = 0;
+            }
+        }
+    }
+
+    if (joystick_fd >= 0) {
+        close(joystick_fd);
+    }
+    if (feeding) {
+        joystick_feed_stop(&feed);
+    }
+    if (pad.capture != NULL && fclose(pad.capture) != 0) {
+        perror("Error writing joystick capture");
+    }
+    arm_send_stop_all(arm);
+    arm_controller_close(arm, stdout);
+    input_map_free(&input_map);
+    return 0;
+}
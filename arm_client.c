@@ -0,0 +1,132 @@
+#include "arm_wire.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arm_protocol.h"
+
+static const char *const wire_command_text[] = {
+    [COMMAND_STATE_NONE] = "none",
+    [COMMAND_STATE_GOOD] = "good",
+    [COMMAND_STATE_BAD] = "bad",
+};
+
+//sends a request and waits for its reply; -1 with errno set if either failed or the daemon refused it
+static int arm_client_call(int fd, struct arm_wire_message *msg, size_t len) {
+    const uint8_t type = msg->type;
+    if (send(fd, msg, len, MSG_NOSIGNAL) == -1) {
+        return -1;
+    }
+    ssize_t received;
+    do {
+        received = recv(fd, msg, sizeof(*msg), 0);
+    } while (received == -1 && errno == EINTR);
+    if (received < (ssize_t) ARM_WIRE_HEADER_LEN || msg->type != (type | ARM_WIRE_REPLY)) {
+        if (received >= 0) errno = EPROTO;
+        return -1;
+    }
+    if (msg->result < 0) {
+        errno = -msg->result;
+        return -1;
+    }
+    return 0;
+}
+
+static int arm_client_open(void *target) {
+    const struct arm_client_target *client = target;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(client->path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, client->path);
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct arm_wire_message hello = {
+        .type = ARM_WIRE_HELLO,
+        .arg = { ARM_WIRE_VERSION, (uint8_t) client->priority },
+    };
+    if (connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1
+            || arm_client_call(fd, &hello, ARM_WIRE_HEADER_LEN) == -1) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+//text commands go over as joint changes where they are one, so the daemon can merge them
+static ssize_t arm_client_write(int fd, const void *buf, size_t len) {
+    struct arm_wire_message msg = { .type = ARM_WIRE_TEXT };
+    enum joint joint;
+    enum joint_direction direction;
+    size_t msg_len = ARM_WIRE_HEADER_LEN;
+
+    if (len == strlen("stop:all") && memcmp(buf, "stop:all", len) == 0) {
+        msg.type = ARM_WIRE_STOP_ALL;
+    } else if (parse_joint_command(buf, len, &joint, &direction) == 0) {
+        msg.type = ARM_WIRE_JOINT;
+        msg.arg[0] = (uint8_t) joint;
+        msg.arg[1] = (uint8_t) direction;
+    } else {
+        if (len >= sizeof(msg.text)) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        msg.arg[0] = (uint8_t) len;
+        memcpy(msg.text, buf, len);
+        msg_len += len;
+    }
+    return arm_client_call(fd, &msg, msg_len) == -1 ? -1 : (ssize_t) len;
+}
+
+//answers with a status line in the driver's format, built from the daemon's last reading
+static ssize_t arm_client_read(int fd, void *buf, size_t len) {
+    struct arm_wire_message msg = { .type = ARM_WIRE_STATUS };
+    if (arm_client_call(fd, &msg, ARM_WIRE_HEADER_LEN) == -1) {
+        return -1;
+    }
+    const unsigned int command = msg.arg[1] <= COMMAND_STATE_BAD ? msg.arg[1] : COMMAND_STATE_NONE;
+    char line[64];
+    int line_len;
+    // Passed on as a reading parse_robot_status also treats as out of range
+    if (msg.arg[2] == 0xFF) {
+        line_len = snprintf(line, sizeof(line), "connected:%s status:%s battery:%d\n", msg.arg[0] ? "yes" : "no",
+                            wire_command_text[command], BATTERY_MAX + 1);
+    } else {
+        line_len = snprintf(line, sizeof(line), "connected:%s status:%s battery:%u\n", msg.arg[0] ? "yes" : "no",
+                            wire_command_text[command], msg.arg[2]);
+    }
+    const size_t copied = (size_t) line_len < len ? (size_t) line_len : len;
+    memcpy(buf, line, copied);
+    return (ssize_t) copied;
+}
+
+static int arm_client_ioctl(int fd, unsigned long request, void *arg) {
+    if (request != IOCTL_SET_VALUE) {
+        errno = ENOTTY;
+        return -1;
+    }
+    const struct device_command *frame = arg;
+    struct arm_wire_message msg = {
+        .type = ARM_WIRE_RAW,
+        .frame = { frame->var1, frame->var2, frame->var3 },
+    };
+    return arm_client_call(fd, &msg, ARM_WIRE_HEADER_LEN);
+}
+
+const struct device_ops arm_client_ops = {
+    .open = arm_client_open,
+    .write = arm_client_write,
+    .read = arm_client_read,
+    .ioctl = arm_client_ioctl,
+};
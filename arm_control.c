@@ -0,0 +1,685 @@
+#include "arm_control.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#include "arm_device.h"
+#include "arm_latency.h"
+#include "arm_metrics.h"
+#include "arm_status.h"
+#include "arm_time.h"
+#include "arm_trace.h"
+
+struct arm_controller {
+    struct arm_options options;
+    struct device_session session;
+    struct mock_arm mock;
+    struct arm_client_target client;
+    struct command_recorder recorder;
+    struct status_poller poller;
+    struct command_dispatcher dispatcher;
+    struct motion_scheduler motion;
+    struct watchdog watchdog;
+    bool poller_started;
+    bool motion_started;
+    bool watchdog_started;
+    /*
+     * What every joint was last asked to do, whichever source asked: the one
+     * place that decides whether a joint command is a change. Sources still
+     * track their own inputs (a held key, a stick zone) but not the arm.
+     */
+    atomic_uchar joint_state[JOINT_COUNT];  // enum joint_direction, or JOINT_STATE_UNKNOWN
+    atomic_ulong seen_dropped;              // writer drops already accounted for in joint_state
+    atomic_ulong suppressed;                // joint commands not sent because nothing would change
+    atomic_ulong emergency_stops;
+};
+
+#define JOINT_STATE_UNKNOWN 0xFF
+
+//source the calling thread bound, SOURCE_COUNT if none
+static _Thread_local enum input_source bound_source = SOURCE_COUNT;
+
+//as threads are named in a trace
+static const char *const source_thread_names[SOURCE_COUNT] = {
+    [SOURCE_UI] = "ui",
+    [SOURCE_JOYSTICK] = "joystick",
+    [SOURCE_MOTION] = "motion",
+    [SOURCE_WATCHDOG] = "watchdog",
+};
+
+static const char *const source_names[SOURCE_COUNT] = {
+    [SOURCE_UI] = "the UI",
+    [SOURCE_JOYSTICK] = "the joystick",
+    [SOURCE_MOTION] = "the motion scheduler",
+    [SOURCE_WATCHDOG] = "the watchdog",
+};
+
+int arm_options_parse_arg(struct arm_options *options, const char *arg) {
+    if (strcmp(arg, "--ioctl") == 0) {
+        options->transport = TRANSPORT_IOCTL;
+    } else if (strcmp(arg, "--text") == 0) {
+        options->transport = TRANSPORT_TEXT;
+    } else if (strncmp(arg, "--rate=", strlen("--rate=")) == 0) {
+        char *end;
+        const unsigned long rate_hz = strtoul(arg + strlen("--rate="), &end, 10);
+        if (*end != '\0' || rate_hz < CONTROL_RATE_MIN_HZ || rate_hz > CONTROL_RATE_MAX_HZ) {
+            fprintf(stderr, "--rate must be between %d and %d Hz\n", CONTROL_RATE_MIN_HZ, CONTROL_RATE_MAX_HZ);
+            return -1;
+        }
+        options->rate_hz = (unsigned int) rate_hz;
+    } else if (strcmp(arg, "--realtime") == 0) {
+        options->realtime = true;
+    } else if (strcmp(arg, "--proportional") == 0) {
+        options->pulse_hz = MOTION_PULSE_DEFAULT_HZ;
+    } else if (strncmp(arg, "--proportional=", strlen("--proportional=")) == 0) {
+        char *end;
+        const unsigned long pulse_hz = strtoul(arg + strlen("--proportional="), &end, 10);
+        if (*end != '\0' || pulse_hz < MOTION_PULSE_MIN_HZ || pulse_hz > MOTION_PULSE_MAX_HZ) {
+            fprintf(stderr, "--proportional must be between %d and %d Hz\n", MOTION_PULSE_MIN_HZ, MOTION_PULSE_MAX_HZ);
+            return -1;
+        }
+        options->pulse_hz = (unsigned int) pulse_hz;
+    } else if (strncmp(arg, "--ramp=", strlen("--ramp=")) == 0) {
+        char *end;
+        const unsigned long ramp_ms = strtoul(arg + strlen("--ramp="), &end, 10);
+        if (*end != '\0' || ramp_ms > 10000) {
+            fprintf(stderr, "--ramp must be between 0 and 10000 ms\n");
+            return -1;
+        }
+        options->ramp_ms = (unsigned int) ramp_ms;
+    } else if (strncmp(arg, "--watchdog=", strlen("--watchdog=")) == 0) {
+        char *end;
+        const unsigned long watchdog_ms = strtoul(arg + strlen("--watchdog="), &end, 10);
+        if (*end != '\0' || watchdog_ms < WATCHDOG_MIN_MS || watchdog_ms > WATCHDOG_MAX_MS) {
+            fprintf(stderr, "--watchdog must be between %d and %d ms\n", WATCHDOG_MIN_MS, WATCHDOG_MAX_MS);
+            return -1;
+        }
+        options->watchdog_ms = (unsigned int) watchdog_ms;
+    } else if (strncmp(arg, "--limit=", strlen("--limit=")) == 0) {
+        if (rate_limit_parse_config(arg + strlen("--limit="), &options->limit) != 0) {
+            fprintf(stderr, "--limit takes HZ[,JOINT_HZ[,BURST]], rates between %d and %d\n", LIMIT_MIN_HZ, LIMIT_MAX_HZ);
+            return -1;
+        }
+    } else if (strcmp(arg, "--mock") == 0) {
+        options->mock = true;
+    } else if (strncmp(arg, "--mock=", strlen("--mock=")) == 0) {
+        if (mock_arm_parse_config(arg + strlen("--mock="), &options->mock_config) != 0) {
+            fprintf(stderr, "--mock takes DELAY_US[,FAIL_EVERY[,JITTER_US[,BATTERY]]]\n");
+            return -1;
+        }
+        options->mock = true;
+    } else if (strncmp(arg, "--record=", strlen("--record=")) == 0) {
+        options->record_path = arg + strlen("--record=");
+    } else if (strncmp(arg, "--trace=", strlen("--trace=")) == 0) {
+        options->trace_path = arg + strlen("--trace=");
+    } else if (strncmp(arg, "--metrics=", strlen("--metrics=")) == 0) {
+        options->metrics_path = arg + strlen("--metrics=");
+    } else if (strcmp(arg, "--connect") == 0) {
+        options->connect_path = ARM_DAEMON_SOCKET;
+    } else if (strncmp(arg, "--connect=", strlen("--connect=")) == 0) {
+        options->connect_path = arg + strlen("--connect=");
+    } else if (strncmp(arg, "--priority=", strlen("--priority=")) == 0) {
+        char *end;
+        const unsigned long priority = strtoul(arg + strlen("--priority="), &end, 10);
+        if (*end != '\0' || priority > 255) {
+            fprintf(stderr, "--priority must be between 0 and 255\n");
+            return -1;
+        }
+        options->priority = (unsigned int) priority;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+//status_poller callback, passes the reading on to whoever opened the controller
+static void arm_controller_status_changed(const struct robot_status *status, void *data) {
+    struct arm_controller *arm = data;
+    arm->options.on_status(status, arm->options.data);
+}
+
+static void arm_controller_command_failed(void *data) {
+    struct arm_controller *arm = data;
+    arm->options.on_command_failed(arm->options.data);
+}
+
+//the motion scheduler's pulses are joint commands like any other, from their own ring
+static int arm_controller_motion_send(void *data, enum joint joint, enum joint_direction direction) {
+    return arm_send_joint(data, joint, direction);
+}
+
+static void arm_controller_motion_bind(void *data) {
+    arm_controller_bind_source(data, SOURCE_MOTION);
+}
+
+//unknown counts as moving: better a stop too many than a runaway
+static bool arm_controller_joint_moving(void *data, enum joint joint) {
+    struct arm_controller *arm = data;
+    if (atomic_load_explicit(&arm->joint_state[joint], memory_order_relaxed) != JOINT_STOP) {
+        return true;
+    }
+    // Between two of its pulses a scheduled joint reads as stopped
+    return arm->motion_started && atomic_load_explicit(&arm->motion.target[joint], memory_order_relaxed) != 0;
+}
+
+static int arm_controller_watchdog_expired(void *data, enum joint joint, enum input_source source,
+                                           unsigned int silent_ms) {
+    struct arm_controller *arm = data;
+    const char *name = joint_encodings[joint].text[JOINT_STOP];  // "base:stop"
+    TRACE_WARN(TRACE_WATCHDOG_EXPIRED, joint, source, silent_ms);
+    fprintf(stderr, "Watchdog: nothing from %s for %u ms with the %.*s moving, stopping the arm\n",
+            source_names[source], silent_ms, (int) strcspn(name, ":"), name);
+    return arm_send_stop_all(arm);
+}
+
+static void arm_controller_watchdog_bind(void *data) {
+    arm_controller_bind_source(data, SOURCE_WATCHDOG);
+}
+
+//adds the command queue's counters to each metrics export (exporter thread)
+static void arm_controller_collect_metrics(FILE *out, void *data) {
+    struct arm_controller *arm = data;
+    struct dispatcher_stats stats;
+    command_dispatcher_get_stats(&arm->dispatcher, &stats);
+    metrics_write_gauge(out, "arm_queue_depth", "Commands waiting for the writer", stats.depth);
+    metrics_write_gauge(out, "arm_queue_max_depth", "Most commands waiting in one input's queue so far", stats.max_depth);
+    metrics_write_counter(out, "arm_commands_queued", "Commands accepted into the queue", stats.enqueued);
+    metrics_write_counter(out, "arm_commands_written", "Queued commands delivered to the arm", stats.written);
+    metrics_write_counter(out, "arm_commands_overflowed", "Commands refused because the queue was full", stats.overflows);
+    metrics_write_counter(out, "arm_commands_dropped", "Commands given up on after a device error", stats.dropped);
+    metrics_write_counter(out, "arm_commands_suppressed", "Joint commands not sent as the joint was already doing that",
+                          atomic_load(&arm->suppressed));
+    metrics_write_counter(out, "arm_stops", "Stops sent ahead of the queue", stats.stops);
+    metrics_write_counter(out, "arm_emergency_stops", "Emergency stops", atomic_load(&arm->emergency_stops));
+}
+
+struct arm_controller* arm_controller_open(const struct arm_options *options) {
+    if (options->mock && options->connect_path != NULL) {
+        fprintf(stderr, "--mock and --connect can't be used together, start arm_daemon with --mock instead\n");
+        return NULL;
+    }
+
+    struct arm_controller *arm = calloc(1, sizeof(*arm));
+    if (arm == NULL) {
+        perror("Failed to allocate arm controller");
+        return NULL;
+    }
+    arm->options = *options;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        arm->joint_state[joint] = JOINT_STATE_UNKNOWN;
+    }
+
+    arm->session.fd = -1;
+    pthread_mutex_init(&arm->session.lock, NULL);
+    if (options->mock) {
+        // Stand-in arm for working without the hardware
+        mock_arm_init(&arm->mock, &options->mock_config);
+        arm->session.ops = &mock_arm_ops;
+        arm->session.target = &arm->mock;
+    } else if (options->connect_path != NULL) {
+        // Another process owns the arm, commands and status go through it
+        arm->client.path = options->connect_path;
+        arm->client.priority = options->priority;
+        arm->session.ops = &arm_client_ops;
+        arm->session.target = &arm->client;
+    } else {
+        arm->session.ops = &device_node_ops;
+        arm->session.target = (void *) DEVICE_PATH;
+    }
+    pthread_mutex_init(&arm->poller.lock, NULL);
+    arm->poller.interval_ms = STATUS_POLL_FAST_MS;
+    pthread_mutex_init(&arm->dispatcher.lock, NULL);
+
+    // Fault everything in now so the control loop never waits on a page
+    if (options->realtime && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall failed, control loop may see paging delays");
+    }
+
+    if (options->record_path != NULL && command_recorder_open(&arm->recorder, options->record_path) != 0) {
+        if (options->mock) {
+            mock_arm_destroy(&arm->mock);
+        }
+        free(arm);
+        return NULL;
+    }
+    // Before any thread starts, so each one's first records are kept
+    if (options->trace_path != NULL && trace_open(options->trace_path) != 0) {
+        command_recorder_close(&arm->recorder);
+        if (options->mock) {
+            mock_arm_destroy(&arm->mock);
+        }
+        free(arm);
+        return NULL;
+    }
+
+    const struct dispatcher_config config = {
+        .transport = options->transport,
+        .rate_hz = options->rate_hz,
+        .realtime = options->realtime,
+        .poller = &arm->poller,
+        .command_failed = options->on_command_failed != NULL ? arm_controller_command_failed : NULL,
+        .recorder = options->record_path != NULL ? &arm->recorder : NULL,
+        .limit = options->limit,
+        .data = arm,
+    };
+    if (command_dispatcher_start(&arm->dispatcher, &arm->session, &config) != 0) {
+        perror("Failed to create device writer thread");
+        trace_close();
+        command_recorder_close(&arm->recorder);
+        if (options->mock) {
+            mock_arm_destroy(&arm->mock);
+        }
+        free(arm);
+        return NULL;
+    }
+
+    if (options->pulse_hz > 0) {
+        arm->motion_started = motion_scheduler_start(&arm->motion, options->pulse_hz, options->ramp_ms,
+                                                     arm_controller_motion_send, arm_controller_motion_bind,
+                                                     arm) == 0;
+        if (!arm->motion_started) {
+            perror("Failed to create motion scheduler thread, joints will only go full speed");
+        }
+    }
+
+    if (options->watchdog_ms > 0) {
+        arm->watchdog_started = watchdog_start(&arm->watchdog, options->watchdog_ms, arm_controller_joint_moving,
+                                               arm_controller_watchdog_expired, arm_controller_watchdog_bind,
+                                               arm) == 0;
+        if (!arm->watchdog_started) {
+            perror("Failed to create watchdog thread, nothing will stop a silent source's joints");
+        }
+    }
+
+    // Status is read on its own timer, off the command path
+    arm->poller_started = status_poller_start(&arm->poller, &arm->session,
+                                              options->on_status != NULL ? arm_controller_status_changed : NULL,
+                                              arm) == 0;
+    if (!arm->poller_started) {
+        perror("Failed to create status poller thread");
+    }
+
+    if (options->metrics_path != NULL
+            && metrics_export_start(options->metrics_path, arm_controller_collect_metrics, arm) != 0) {
+        fprintf(stderr, "Carrying on without metrics\n");
+    }
+    return arm;
+}
+
+void arm_controller_close(struct arm_controller *arm, FILE *report) {
+    if (arm->watchdog_started) {
+        watchdog_stop(&arm->watchdog);
+    }
+    // Its last stops go in the queue before the writer drains it
+    if (arm->motion_started) {
+        motion_scheduler_stop(&arm->motion);
+    }
+    command_dispatcher_stop(&arm->dispatcher);
+    if (arm->poller_started) {
+        status_poller_stop(&arm->poller);
+    }
+    // After the threads, so the last export has everything they counted
+    metrics_export_stop();
+
+    if (report != NULL && arm->options.record_path != NULL) {
+        fprintf(report, "Command log: %lu commands recorded to %s\n", arm->recorder.entries, arm->options.record_path);
+    }
+    command_recorder_close(&arm->recorder);
+    trace_close();
+    if (report != NULL && arm->options.trace_path != NULL) {
+        fprintf(report, "Trace: written to %s, read it with arm_tracedump\n", arm->options.trace_path);
+    }
+    if (report != NULL && arm->options.metrics_path != NULL) {
+        fprintf(report, "Metrics: exported to %s\n", arm->options.metrics_path);
+    }
+
+    if (report != NULL) {
+        struct dispatcher_stats stats;
+        command_dispatcher_get_stats(&arm->dispatcher, &stats);
+        fprintf(report, "Command queue: %lu queued, %lu written (%lu coalesced), %lu dropped, %lu overflowed, max depth %u/%d\n",
+                stats.enqueued, stats.written, stats.coalesced, stats.dropped, stats.overflows, stats.max_depth, COMMAND_QUEUE_SIZE);
+        fprintf(report, "Stop lane: %lu stops sent ahead of the queue, %lu queued moves cancelled, %lu emergency stops\n",
+                stats.stops, stats.cancelled, atomic_load(&arm->emergency_stops));
+        if (arm->options.limit.link_hz > 0) {
+            fprintf(report, "Limiter at %u calls/s, %u changes/s per joint: %lu merged, %lu delayed, %lu rejected\n",
+                    arm->options.limit.link_hz, arm->options.limit.joint_hz, stats.merged, stats.delayed, stats.rejected);
+        }
+        fprintf(report, "Joint state: %lu commands not sent as the joint was already doing that\n",
+                atomic_load(&arm->suppressed));
+        if (arm->watchdog_started) {
+            fprintf(report, "Watchdog: %lu stops after %u ms of silence\n",
+                    atomic_load(&arm->watchdog.expiries), arm->options.watchdog_ms);
+        }
+        if (arm->motion_started) {
+            const struct motion_stats *motion = &arm->motion.stats;
+            fprintf(report, "Motion scheduler at %u Hz: %lu ticks, %lu pulses, %lu refused\n",
+                    arm->options.pulse_hz, motion->ticks, motion->pulses, motion->refused);
+        }
+
+        latency_dump(report);
+
+        if (arm->options.rate_hz > 0) {
+            const struct control_loop_stats *loop = &arm->dispatcher.loop_stats;
+            fprintf(report, "Control loop at %u Hz: %lu ticks, %lu overruns, %lu missed ticks\n",
+                    arm->options.rate_hz, loop->ticks, loop->overruns, loop->missed_ticks);
+            tick_histogram_print(report, "Tick jitter", &loop->jitter);
+            tick_histogram_print(report, "Tick overrun", &loop->overrun);
+        }
+    }
+
+    device_session_close(&arm->session);
+    if (arm->options.mock) {
+        mock_arm_destroy(&arm->mock);
+    }
+    free(arm);
+}
+
+void arm_controller_bind_source(struct arm_controller *arm, enum input_source source) {
+    command_dispatcher_bind_producer(&arm->dispatcher, source);
+    bound_source = source;
+    trace_name_thread(source_thread_names[source]);
+}
+
+void arm_controller_heartbeat(struct arm_controller *arm) {
+    if (arm->watchdog_started && bound_source < SOURCE_COUNT) {
+        watchdog_heartbeat(&arm->watchdog, bound_source);
+    }
+}
+
+int arm_controller_heartbeat_ms(struct arm_controller *arm) {
+    // A few beats per deadline, so one late wakeup doesn't trip it
+    return arm->watchdog_started ? (int) arm->options.watchdog_ms / 4 : -1;
+}
+
+/*
+ * A joint just set moving is watched on behalf of the calling thread's source.
+ * The motion scheduler's pulses are not a source of their own: its joints stay
+ * with whoever gave them a speed. Only called when a joint starts moving.
+ */
+static void watchdog_note_moving(struct arm_controller *arm, enum joint joint) {
+    if (arm->watchdog_started && joint != JOINT_LED && bound_source < SOURCE_COUNT && bound_source != SOURCE_MOTION) {
+        watchdog_arm(&arm->watchdog, joint, bound_source);
+    }
+}
+
+static void joint_state_forget(struct arm_controller *arm) {
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        atomic_store(&arm->joint_state[joint], JOINT_STATE_UNKNOWN);
+    }
+}
+
+/*
+ * A command the writer gave up on may have left the arm anywhere, so after
+ * any drop the next command for every joint goes out whatever was asked before.
+ */
+static void joint_state_check_drops(struct arm_controller *arm) {
+    const unsigned long dropped = atomic_load_explicit(&arm->dispatcher.dropped, memory_order_relaxed);
+    if (dropped != atomic_load_explicit(&arm->seen_dropped, memory_order_relaxed)) {
+        atomic_store_explicit(&arm->seen_dropped, dropped, memory_order_relaxed);
+        joint_state_forget(arm);
+    }
+}
+
+/*
+ * A stop is recorded after it was asked for, so a move queued after the stop
+ * can't find the joint recorded as stopped: a joint that changed from before
+ * meanwhile is left unknown instead.
+ */
+static void joint_state_stopped(struct arm_controller *arm, enum joint joint, unsigned char before) {
+    if (!atomic_compare_exchange_strong(&arm->joint_state[joint], &before, JOINT_STOP)) {
+        atomic_store(&arm->joint_state[joint], JOINT_STATE_UNKNOWN);
+    }
+}
+
+//every motor stopped, the LED left as it was, as encode_stop_all does
+static void joint_state_stop_all(struct arm_controller *arm, const unsigned char before[JOINT_COUNT]) {
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (joint != JOINT_LED) {
+            joint_state_stopped(arm, joint, before[joint]);
+        }
+    }
+}
+
+//every joint as a frame sets it, or unknown if the frame isn't one the arm takes
+static void joint_state_from_frame(struct arm_controller *arm, const struct device_command *frame) {
+    if (!frame_is_valid(frame)) {
+        joint_state_forget(arm);
+        return;
+    }
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        atomic_store(&arm->joint_state[joint], (unsigned char) decode_joint(frame, joint));
+    }
+}
+
+/**
+ * Queues a move or stop for one joint, sent as text or as an encoded frame
+ * depending on the transport picked at startup. Nothing is queued if the
+ * joint was already asked to do the same, by this source or any other.
+ * @return 0 if queued or not needed, -1 if the queue is full.
+ */
+int arm_send_joint(struct arm_controller *arm, enum joint joint, enum joint_direction direction) {
+
+    joint_state_check_drops(arm);
+    // Stops jump the queue; the scheduler's gaps between pulses are speed, not stops, and stay in order
+    const bool lane = direction == JOINT_STOP && joint != JOINT_LED && bound_source != SOURCE_MOTION;
+    // Stamped before the state changes, so a stop that finds the change was asked for after this move
+    const long long queued_ns = monotonic_ns();
+    const unsigned char before = lane ? atomic_load(&arm->joint_state[joint])
+                                      : atomic_exchange(&arm->joint_state[joint], (unsigned char) direction);
+    if (before == direction) {
+        atomic_fetch_add_explicit(&arm->suppressed, 1, memory_order_relaxed);
+        TRACE_DEBUG(TRACE_SUPPRESSED, joint, direction);
+        return 0;
+    }
+    if (direction != JOINT_STOP) {
+        watchdog_note_moving(arm, joint);
+    }
+
+    TRACE_DEBUG(TRACE_SEND_JOINT, joint, direction, bound_source);
+    if (arm->options.verbose) {
+        printf("Sending command: %s\n", joint_encodings[joint].text[direction]);
+    }
+
+    if (lane) {
+        command_dispatcher_request_stop(&arm->dispatcher, 1u << joint);
+        joint_state_stopped(arm, joint, before);
+        return 0;
+    }
+
+    const struct queued_command cmd = { .kind = COMMAND_JOINT, .joint = joint, .direction = direction };
+    if (command_dispatcher_enqueue_at(&arm->dispatcher, &cmd, queued_ns) == -1) {
+        fprintf(stderr, "Command queue full, dropped: %s\n", joint_encodings[joint].text[direction]);
+        TRACE_WARN(TRACE_QUEUE_FULL, COMMAND_JOINT);
+        atomic_store(&arm->joint_state[joint], JOINT_STATE_UNKNOWN);
+        return -1;
+    }
+    // A stop asked for since the stamp drops this move, so it mustn't stay recorded
+    if (command_dispatcher_overtaken(&arm->dispatcher, joint, queued_ns)) {
+        unsigned char moved = (unsigned char) direction;
+        atomic_compare_exchange_strong(&arm->joint_state[joint], &moved, JOINT_STATE_UNKNOWN);
+    }
+    return 0;
+}
+
+//stops every motor ahead of the queue, always, whatever the joints were last asked to do
+int arm_send_stop_all(struct arm_controller *arm) {
+
+    TRACE_INFO(TRACE_SEND_STOP_ALL, bound_source);
+    if (arm->options.verbose) {
+        printf("Sending command: stop:all\n");
+    }
+
+    joint_state_check_drops(arm);
+    if (arm->motion_started) {
+        motion_scheduler_halt(&arm->motion);
+    }
+    unsigned char before[JOINT_COUNT];
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        before[joint] = atomic_load(&arm->joint_state[joint]);
+    }
+    command_dispatcher_request_stop(&arm->dispatcher, STOP_LANE_ALL);
+    joint_state_stop_all(arm, before);
+    return 0;
+}
+
+int arm_emergency_stop(struct arm_controller *arm) {
+    fprintf(stderr, "Emergency stop\n");
+    TRACE_WARN(TRACE_EMERGENCY_STOP, bound_source);
+    atomic_fetch_add_explicit(&arm->emergency_stops, 1, memory_order_relaxed);
+    return arm_send_stop_all(arm);
+}
+
+//queues a frame exactly as given, sent with IOCTL_SET_VALUE whatever the transport
+int arm_send_raw(struct arm_controller *arm, const struct device_command *frame) {
+
+    TRACE_DEBUG(TRACE_SEND_RAW, frame->var1, frame->var2, frame->var3);
+    if (arm->options.verbose) {
+        printf("Sending command: %d,%d,%d\n", frame->var1, frame->var2, frame->var3);
+    }
+
+    joint_state_check_drops(arm);
+    const struct queued_command cmd = { .kind = COMMAND_IOCTL, .raw = *frame };
+    if (command_dispatcher_enqueue(&arm->dispatcher, &cmd) == -1) {
+        fprintf(stderr, "Command queue full, dropped: %d,%d,%d\n", frame->var1, frame->var2, frame->var3);
+        TRACE_WARN(TRACE_QUEUE_FULL, COMMAND_IOCTL);
+        return -1;
+    }
+    joint_state_from_frame(arm, frame);
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (decode_joint(frame, joint) != JOINT_STOP) {
+            watchdog_note_moving(arm, joint);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Queues a free-form command for the A37JN robot arm; the writer thread sends it via the device file.
+ * @param text: The command string to send (e.g., "base:left").
+ * @return 0 if queued, -1 if it was too long or the queue is full.
+ */
+int arm_send_text(struct arm_controller *arm, const char *text) {
+    // Text naming a joint, or stop:all, goes the way its button would, so there's one record of state
+    const size_t len = strlen(text);
+    enum joint joint;
+    enum joint_direction direction;
+    if (parse_joint_command(text, len, &joint, &direction) == 0) {
+        return arm_send_joint(arm, joint, direction);
+    }
+    if (strcmp(text, "stop:all") == 0) {
+        return arm_send_stop_all(arm);
+    }
+
+    TRACE_TEXT_AT(TRACE_LEVEL_DEBUG, TRACE_SEND_TEXT, text, len);
+    if (arm->options.verbose) {
+        printf("Sending command: %s\n", text);
+    }
+
+    struct queued_command cmd = { .kind = COMMAND_TEXT };
+    if (len >= sizeof(cmd.text)) {
+        fprintf(stderr, "Command too long: %s\n", text);
+        return -1;
+    }
+    memcpy(cmd.text, text, len + 1);
+
+    if (command_dispatcher_enqueue(&arm->dispatcher, &cmd) == -1) {
+        fprintf(stderr, "Command queue full, dropped: %s\n", text);
+        TRACE_WARN(TRACE_QUEUE_FULL, COMMAND_TEXT);
+        return -1;
+    }
+    return 0;
+}
+
+int arm_send_speed(struct arm_controller *arm, enum joint joint, enum joint_direction direction, unsigned int level) {
+    if (!arm->motion_started || joint == JOINT_LED) {
+        return arm_send_joint(arm, joint, level > 0 ? direction : JOINT_STOP);
+    }
+    if (direction != JOINT_STOP && level > 0) {
+        watchdog_note_moving(arm, joint);
+    }
+    motion_scheduler_set(&arm->motion, joint, direction, level);
+    return 0;
+}
+
+bool arm_controller_proportional(struct arm_controller *arm) {
+    return arm->motion_started;
+}
+
+bool arm_controller_get_status(struct arm_controller *arm, struct robot_status *out) {
+    pthread_mutex_lock(&arm->poller.lock);
+    const bool have = arm->poller.have_latest;
+    if (have) {
+        *out = arm->poller.latest;
+    }
+    pthread_mutex_unlock(&arm->poller.lock);
+    return have;
+}
+
+void arm_controller_forget_status(struct arm_controller *arm) {
+    status_poller_invalidate(&arm->poller);
+}
+
+void arm_controller_get_stats(struct arm_controller *arm, struct dispatcher_stats *out) {
+    command_dispatcher_get_stats(&arm->dispatcher, out);
+}
+
+//one logged command, joint commands and stop:all by name so the joint state follows them
+static int replay_send(struct arm_controller *arm, const struct command_log_entry *entry) {
+    if (entry->kind == COMMAND_LOG_FRAME) {
+        return arm_send_raw(arm, &entry->frame);
+    }
+    enum joint joint;
+    enum joint_direction direction;
+    if (parse_joint_command(entry->text, strlen(entry->text), &joint, &direction) == 0) {
+        return arm_send_joint(arm, joint, direction);
+    }
+    if (strcmp(entry->text, "stop:all") == 0) {
+        return arm_send_stop_all(arm);
+    }
+    return arm_send_text(arm, entry->text);
+}
+
+void arm_replay_log(struct arm_controller *arm, struct command_log *log, double speed,
+                    const volatile sig_atomic_t *cancel, struct arm_replay_stats *stats) {
+    struct command_log_entry entry;
+    memset(stats, 0, sizeof(*stats));
+    if (!command_log_next(log, &entry)) {
+        return;
+    }
+
+    // Default timer slack alone would put every wakeup ~50us late
+    const int old_slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+
+    const long long first_ns = entry.time_ns;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do {
+        // Absolute deadlines from the start, so sleep overshoot never adds up over a long log
+        const long long offset_ns = entry.time_ns > first_ns ? entry.time_ns - first_ns : 0;
+        struct timespec due = start;
+        timespec_add_ns(&due, (long long) ((double) offset_ns / speed));
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR
+                && (cancel == NULL || !*cancel)) {
+        }
+        if (cancel != NULL && *cancel) break;
+        tick_histogram_add(&stats->lateness, (monotonic_ns() - timespec_ns(&due)) / 1000);
+
+        latency_mark_input();
+        const int sent = replay_send(arm, &entry);
+        latency_clear_input();
+        if (sent == 0) {
+            stats->sent++;
+        } else {
+            stats->refused++;
+        }
+    } while (command_log_next(log, &entry));
+
+    if (old_slack >= 0) {
+        prctl(PR_SET_TIMERSLACK, (unsigned long) old_slack, 0, 0, 0);
+    }
+}
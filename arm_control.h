@@ -0,0 +1,141 @@
+#ifndef ARM_CONTROL_H
+#define ARM_CONTROL_H
+
+/*
+ * Public API of the arm core library. A controller owns the device session
+ * (the real arm or the mock), the status poller and the command dispatcher;
+ * front ends (the GTK app, the CLI) only talk to it through these calls.
+ *
+ * Every thread that sends commands must first claim its own input source
+ * with arm_controller_bind_source, the queue has one lock-free ring per source.
+ */
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arm_dispatcher.h"
+#include "arm_limit.h"
+#include "arm_motion.h"
+#include "arm_protocol.h"
+#include "arm_record.h"
+#include "arm_watchdog.h"
+#include "arm_wire.h"
+#include "mock_arm.h"
+
+struct arm_options {
+    enum command_transport transport;
+    unsigned int rate_hz;             // fixed-rate control loop, 0 = event driven
+    bool realtime;                    // SCHED_FIFO control loop and mlockall, needs rate_hz
+    unsigned int pulse_hz;            // proportional speed through the motion scheduler, 0 = joints only on or off
+    unsigned int ramp_ms;             // with pulse_hz: soft start and stop, stopped to full speed
+    unsigned int watchdog_ms;         // stop the arm if a source moving it goes this long without a heartbeat, 0 = off
+    struct rate_limit_config limit;   // token buckets in front of the device, see arm_limit.h
+    bool mock;                        // use the in-process mock arm instead of the device
+    struct mock_arm_config mock_config;
+    const char *connect_path;         // go through arm_daemon at this socket instead of opening the arm, NULL if not
+    unsigned int priority;            // with connect_path: higher takes control of the arm from lower
+    const char *record_path;          // log every command sent to the arm here, NULL for none
+    const char *trace_path;           // binary trace of the control path (arm_trace.h), NULL for none
+    const char *metrics_path;         // OpenMetrics file rewritten every second (arm_metrics.h), NULL for none
+    bool verbose;                     // print every command as it is queued
+    //called on the poller thread whenever the arm's status changes, may be NULL
+    void (*on_status)(const struct robot_status *status, void *data);
+    //called on the writer thread when the arm refuses a raw ioctl, may be NULL
+    void (*on_command_failed)(void *data);
+    void *data;
+};
+
+#define ARM_OPTIONS_DEFAULT { .transport = TRANSPORT_TEXT, .mock_config = MOCK_ARM_CONFIG_DEFAULT, \
+                              .priority = ARM_PRIORITY_DEFAULT, .ramp_ms = MOTION_RAMP_DEFAULT_MS, \
+                              .limit = RATE_LIMIT_CONFIG_DEFAULT }
+
+#define ARM_OPTIONS_USAGE "[--text | --ioctl] [--rate=HZ [--realtime]] [--mock[=DELAY_US[,FAIL_EVERY[,JITTER_US[,BATTERY]]]] | --connect[=SOCKET] [--priority=N]] [--record=FILE] [--trace=FILE] [--metrics=FILE] [--proportional[=HZ] [--ramp=MS]] [--watchdog=MS] [--limit=HZ[,JOINT_HZ[,BURST]]]"
+
+/**
+ * Applies one command line argument to options.
+ * @return 0 if it was used, 1 if it isn't one of ours, -1 if its value is invalid (already reported).
+ */
+int arm_options_parse_arg(struct arm_options *options, const char *arg);
+
+struct arm_controller;
+
+//starts the writer and poller; NULL (with a message printed) if the writer can't run
+struct arm_controller* arm_controller_open(const struct arm_options *options);
+
+//drains what is queued, stops the threads, prints the final statistics to report (NULL for none) and frees
+void arm_controller_close(struct arm_controller *arm, FILE *report);
+
+void arm_controller_bind_source(struct arm_controller *arm, enum input_source source);
+
+/*
+ * Each returns 0 if the command was queued, -1 if it was refused (queue full,
+ * too long). The controller keeps one record of what every joint was last
+ * asked to do, shared by all sources: arm_send_joint queues nothing when the
+ * joint is already doing that. arm_send_raw is always sent and updates it;
+ * arm_send_text sends a joint command or "stop:all" as arm_send_joint or
+ * arm_send_stop_all would, and any other text as it is.
+ *
+ * Stops (arm_send_joint with JOINT_STOP, arm_send_stop_all) don't queue: they
+ * go through the dispatcher's stop lane ahead of everything queued, cancel the
+ * moves they overtake and can't be refused.
+ */
+int arm_send_joint(struct arm_controller *arm, enum joint joint, enum joint_direction direction);
+int arm_send_stop_all(struct arm_controller *arm);
+int arm_send_raw(struct arm_controller *arm, const struct device_command *frame);
+int arm_send_text(struct arm_controller *arm, const char *text);
+
+/**
+ * The E-stop key and button: arm_send_stop_all, reported and counted.
+ * @return 0, it can't be refused.
+ */
+int arm_emergency_stop(struct arm_controller *arm);
+
+/**
+ * Moves a joint at a fraction of full speed, level 0-255 (MOTION_LEVEL_MAX).
+ * With --proportional the motion scheduler pulses the joint at that duty
+ * cycle, ramping from its current speed; this only sets the target, so it
+ * can be called on every stick movement from any thread. Without it, or for
+ * the LED, any level above 0 is arm_send_joint(direction).
+ * @return 0, or -1 as arm_send_joint.
+ */
+int arm_send_speed(struct arm_controller *arm, enum joint joint, enum joint_direction direction, unsigned int level);
+
+//whether arm_send_speed goes through the motion scheduler
+bool arm_controller_proportional(struct arm_controller *arm);
+
+/*
+ * With --watchdog, every source that moves joints must say it is alive at
+ * least every arm_controller_heartbeat_ms, on its own thread, or whatever it
+ * left moving is stopped. Sending commands doesn't count: a stick held still
+ * sends nothing, but its listener is still there. Both are no-ops without it.
+ */
+void arm_controller_heartbeat(struct arm_controller *arm);
+
+//how often to call arm_controller_heartbeat, as a poll() timeout: -1 if there is no watchdog
+int arm_controller_heartbeat_ms(struct arm_controller *arm);
+
+//last status read from the arm, false if there hasn't been one yet
+bool arm_controller_get_status(struct arm_controller *arm, struct robot_status *out);
+
+//makes the next status reading get reported even if it hasn't changed
+void arm_controller_forget_status(struct arm_controller *arm);
+
+void arm_controller_get_stats(struct arm_controller *arm, struct dispatcher_stats *out);
+
+struct arm_replay_stats {
+    unsigned long sent;
+    unsigned long refused;              // the queue was full
+    struct tick_histogram lateness;     // how far behind the log's timing each command was queued
+};
+
+/**
+ * Plays a command log back through arm with the timing it was recorded with,
+ * speed times as fast. Blocks until the log ends or *cancel (may be NULL)
+ * becomes non-zero; the calling thread must have bound an input source.
+ * Logged joint commands and stop:all go through arm_send_joint and
+ * arm_send_stop_all, only other text through arm_send_text.
+ */
+void arm_replay_log(struct arm_controller *arm, struct command_log *log, double speed,
+                    const volatile sig_atomic_t *cancel, struct arm_replay_stats *stats);
+
+#endif
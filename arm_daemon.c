@@ -0,0 +1,372 @@
+/*
+ * Arm daemon: owns the device session so several programs (the GTK app, the
+ * CLI, scripts, a supervisor) can share one arm. Clients connect over a
+ * SOCK_SEQPACKET Unix socket and speak the protocol in arm_wire.h; front ends
+ * get that for free with --connect, which swaps their device backend for
+ * arm_client_ops.
+ *
+ * Only one client has control at a time, see daemon_grant_control for the
+ * policy. Stops are always accepted from anyone.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arm_control.h"
+#include "arm_time.h"
+#include "arm_wire.h"
+
+#define DAEMON_MAX_CLIENTS 16
+#define DAEMON_IDLE_HANDOVER_MS 5000  // an owner quiet for this long can be taken over by anyone
+
+struct daemon_client {
+    int fd;                     // -1 for a free slot
+    unsigned int id;
+    unsigned int priority;
+    bool greeted;               // HELLO received
+    uint64_t last_command_ms;   // last command that needed control
+};
+
+struct arm_daemon {
+    struct arm_controller *arm;
+    struct daemon_client clients[DAEMON_MAX_CLIENTS];
+    struct daemon_client *owner;  // client in control of the arm, NULL if nobody
+    unsigned int next_id;
+};
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void on_quit_signal(int sig) {
+    quit_requested = 1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--socket=PATH] [--text | --ioctl] [--rate=HZ [--realtime]] "
+                    "[--mock[=DELAY_US[,FAIL_EVERY[,JITTER_US[,BATTERY]]]]] [--record=FILE] [--verbose]\n"
+                    "Listens on " ARM_DAEMON_SOCKET " unless --socket is given.\n", argv0);
+}
+
+/**
+ * Binds the listening socket, replacing a socket file left behind by a daemon that died.
+ * @return the socket, or -1 (reported) if it can't listen or another daemon is running.
+ */
+static int daemon_listen(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Failed to create daemon socket");
+        return -1;
+    }
+    // Something answering on the path means a live daemon, not a stale file
+    if (connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) == 0 || errno == EAGAIN) {
+        fprintf(stderr, "Another daemon is already listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    const int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("Failed to create daemon socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1
+            || listen(listen_fd, DAEMON_MAX_CLIENTS) == -1) {
+        perror("Failed to listen on daemon socket");
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+static void daemon_accept(struct arm_daemon *daemon, int listen_fd) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EINTR) perror("accept failed");
+        return;
+    }
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        struct daemon_client *client = &daemon->clients[i];
+        if (client->fd < 0) {
+            *client = (struct daemon_client) { .fd = fd, .id = ++daemon->next_id, .priority = ARM_PRIORITY_DEFAULT };
+            return;
+        }
+    }
+    fprintf(stderr, "Too many clients, refused a connection\n");
+    close(fd);
+}
+
+static void daemon_drop_client(struct arm_daemon *daemon, struct daemon_client *client) {
+    if (client->greeted) {
+        printf("Client %u disconnected\n", client->id);
+    }
+    // Nobody is left holding the controls, so nothing may keep moving
+    if (daemon->owner == client) {
+        arm_send_stop_all(daemon->arm);
+        daemon->owner = NULL;
+    }
+    close(client->fd);
+    client->fd = -1;
+}
+
+/**
+ * The arbitration policy: decides whether client may send a command that moves the arm.
+ * Nobody in control: the client takes it. A client with a higher priority than
+ * the owner takes it over, as does anyone once the owner has been idle for
+ * DAEMON_IDLE_HANDOVER_MS. The arm is stopped on every handover so the new
+ * owner starts from rest.
+ * @return true if client now has control.
+ */
+static bool daemon_grant_control(struct arm_daemon *daemon, struct daemon_client *client) {
+    const uint64_t now = monotonic_ms();
+    struct daemon_client *owner = daemon->owner;
+
+    if (owner != client) {
+        if (owner != NULL && client->priority <= owner->priority
+                && now - owner->last_command_ms < DAEMON_IDLE_HANDOVER_MS) {
+            return false;
+        }
+        if (owner != NULL) {
+            printf("Client %u lost control to client %u\n", owner->id, client->id);
+            arm_send_stop_all(daemon->arm);
+        }
+        printf("Client %u has control\n", client->id);
+        daemon->owner = client;
+    }
+    client->last_command_ms = now;
+    return true;
+}
+
+//0 if the command was queued, -EAGAIN if the dispatcher queue is full
+static int daemon_queued(int sent) {
+    return sent == 0 ? 0 : -EAGAIN;
+}
+
+//acts on one request and fills in its reply in place
+static void daemon_handle(struct arm_daemon *daemon, struct daemon_client *client,
+                          struct arm_wire_message *msg, size_t len) {
+    const uint8_t type = msg->type;
+    int result = 0;
+
+    if (!client->greeted && type != ARM_WIRE_HELLO) {
+        result = -EPROTO;
+    } else switch (type) {
+        case ARM_WIRE_HELLO:
+            if (msg->arg[0] != ARM_WIRE_VERSION) {
+                result = -EPROTONOSUPPORT;
+                break;
+            }
+            client->greeted = true;
+            client->priority = msg->arg[1];
+            printf("Client %u connected (priority %u)\n", client->id, client->priority);
+            break;
+
+        case ARM_WIRE_JOINT:
+            if (msg->arg[0] >= JOINT_COUNT || msg->arg[1] > JOINT_NEG) {
+                result = -EINVAL;
+            } else if (msg->arg[1] != JOINT_STOP && !daemon_grant_control(daemon, client)) {
+                result = -EBUSY;
+            } else {
+                result = daemon_queued(arm_send_joint(daemon->arm, msg->arg[0], msg->arg[1]));
+            }
+            break;
+
+        case ARM_WIRE_STOP_ALL:
+            result = daemon_queued(arm_send_stop_all(daemon->arm));
+            break;
+
+        case ARM_WIRE_RAW: {
+            const struct device_command frame = { .var1 = msg->frame[0], .var2 = msg->frame[1], .var3 = msg->frame[2] };
+            if (!frame_is_valid(&frame)) {
+                result = -EINVAL;
+            } else if ((frame.var1 != 0 || frame.var2 != 0 || frame.var3 != 0) && !daemon_grant_control(daemon, client)) {
+                result = -EBUSY;
+            } else {
+                // Queued as joint changes so the writer's view of the arm stays right
+                for (int joint = 0; joint < JOINT_COUNT && result == 0; joint++) {
+                    result = daemon_queued(arm_send_joint(daemon->arm, joint, decode_joint(&frame, joint)));
+                }
+            }
+            break;
+        }
+
+        case ARM_WIRE_TEXT:
+            if (msg->arg[0] >= ARM_WIRE_TEXT_MAX || len != ARM_WIRE_HEADER_LEN + msg->arg[0]) {
+                result = -EINVAL;
+            } else if (!daemon_grant_control(daemon, client)) {
+                result = -EBUSY;
+            } else {
+                msg->text[msg->arg[0]] = '\0';
+                result = daemon_queued(arm_send_text(daemon->arm, msg->text));
+            }
+            break;
+
+        case ARM_WIRE_STATUS: {
+            struct robot_status status;
+            if (arm_controller_get_status(daemon->arm, &status)) {
+                msg->arg[0] = status.connected;
+                msg->arg[1] = (uint8_t) status.command;
+                msg->arg[2] = status.battery >= 0 && status.battery <= BATTERY_MAX ? (uint8_t) status.battery : 0xFF;
+            } else {
+                msg->arg[0] = 0;
+                msg->arg[1] = COMMAND_STATE_NONE;
+                msg->arg[2] = 0xFF;
+            }
+            break;
+        }
+
+        case ARM_WIRE_ACQUIRE:
+            if (!daemon_grant_control(daemon, client)) {
+                result = -EBUSY;
+            }
+            break;
+
+        case ARM_WIRE_RELEASE:
+            if (daemon->owner == client) {
+                printf("Client %u released control\n", client->id);
+                arm_send_stop_all(daemon->arm);
+                daemon->owner = NULL;
+            }
+            break;
+
+        default:
+            result = -EPROTO;
+            break;
+    }
+
+    msg->type = type | ARM_WIRE_REPLY;
+    msg->result = result;
+}
+
+/**
+ * Reads and answers one request from a client. One per client per poll round,
+ * so a chatty client can't starve the others.
+ * @return false if the client went away or broke protocol and was dropped.
+ */
+static bool daemon_serve(struct arm_daemon *daemon, struct daemon_client *client) {
+    struct arm_wire_message msg;
+    const ssize_t received = recv(client->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+    if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return true;
+    }
+    if (received < (ssize_t) ARM_WIRE_HEADER_LEN) {
+        daemon_drop_client(daemon, client);
+        return false;
+    }
+
+    daemon_handle(daemon, client, &msg, (size_t) received);
+    if (send(client->fd, &msg, ARM_WIRE_HEADER_LEN, MSG_DONTWAIT | MSG_NOSIGNAL) == -1
+            || msg.result == -EPROTO || msg.result == -EPROTONOSUPPORT) {
+        daemon_drop_client(daemon, client);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    struct arm_options options = ARM_OPTIONS_DEFAULT;
+    const char *socket_path = ARM_DAEMON_SOCKET;
+
+    for (int i = 1; i < argc; i++) {
+        // The daemon is what clients connect to, it never is one
+        if (strncmp(argv[i], "--connect", strlen("--connect")) == 0 || strncmp(argv[i], "--priority=", strlen("--priority=")) == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        const int parsed = arm_options_parse_arg(&options, argv[i]);
+        if (parsed < 0) {
+            return 1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "--socket=", strlen("--socket=")) == 0) {
+            socket_path = argv[i] + strlen("--socket=");
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // No SA_RESTART, so poll() returns and the loop sees the request
+    struct sigaction quit_action = { .sa_handler = on_quit_signal };
+    sigemptyset(&quit_action.sa_mask);
+    sigaction(SIGINT, &quit_action, NULL);
+    sigaction(SIGTERM, &quit_action, NULL);
+
+    const int listen_fd = daemon_listen(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    struct arm_daemon daemon = { .owner = NULL };
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        daemon.clients[i].fd = -1;
+    }
+    daemon.arm = arm_controller_open(&options);
+    if (daemon.arm == NULL) {
+        close(listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+    arm_controller_bind_source(daemon.arm, SOURCE_UI);
+
+    // Make sure the arm isn't moving from a previous run
+    arm_send_stop_all(daemon.arm);
+    printf("Listening on %s\n", socket_path);
+    fflush(stdout);
+
+    while (!quit_requested) {
+        struct pollfd fds[DAEMON_MAX_CLIENTS + 1] = { { .fd = listen_fd, .events = POLLIN } };
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            fds[i + 1] = (struct pollfd) { .fd = daemon.clients[i].fd, .events = POLLIN };
+        }
+        arm_controller_heartbeat(daemon.arm);
+        if (poll(fds, DAEMON_MAX_CLIENTS + 1, arm_controller_heartbeat_ms(daemon.arm)) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll failed");
+            break;
+        }
+
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+            struct daemon_client *client = &daemon.clients[i];
+            if (client->fd < 0 || fds[i + 1].revents == 0) continue;
+            if (fds[i + 1].revents & POLLIN) {
+                daemon_serve(&daemon, client);
+            } else {
+                daemon_drop_client(&daemon, client);
+            }
+        }
+        // After the clients, so a new one doesn't land in a slot polled for someone else
+        if (fds[0].revents & POLLIN) {
+            daemon_accept(&daemon, listen_fd);
+        }
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; i++) {
+        if (daemon.clients[i].fd >= 0) {
+            daemon_drop_client(&daemon, &daemon.clients[i]);
+        }
+    }
+    close(listen_fd);
+    unlink(socket_path);
+
+    arm_send_stop_all(daemon.arm);
+    arm_controller_close(daemon.arm, stdout);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "arm_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "arm_metrics.h"
+
+static int device_node_open(void *target) {
+    return open((const char *) target, O_RDWR);
+}
+
+/*
+ * The handle stays open and writes share it, so a driver that advances the
+ * file position would give EOF from the second status read on. Each read
+ * starts at offset 0, as it did when every read opened the device afresh.
+ */
+static ssize_t device_node_read(int fd, void *buf, size_t len) {
+    const ssize_t result = pread(fd, buf, len, 0);
+    if (result == -1 && errno == ESPIPE) {
+        return read(fd, buf, len);  // opened non-seekable, so there is no position to reset
+    }
+    return result;
+}
+
+static int device_node_ioctl(int fd, unsigned long request, void *arg) {
+    return ioctl(fd, request, arg);
+}
+
+const struct device_ops device_node_ops = {
+    .open = device_node_open,
+    .write = write,
+    .read = device_node_read,
+    .ioctl = device_node_ioctl,
+};
+
+//opens the device if it isn't already (lock must be held)
+static int device_session_ensure_open(struct device_session *session) {
+    if (session->fd >= 0) {
+        return 0;
+    }
+    session->fd = session->ops->open(session->target);
+    if (session->fd < 0) {
+        perror("Error opening device file");
+        metrics_add(METRIC_DEVICE_OPEN_ERRORS, 1);
+        return -1;
+    }
+    if (session->lost) {
+        metrics_add(METRIC_DEVICE_RECONNECTS, 1);
+        session->lost = false;
+    }
+    return 0;
+}
+
+//the device turned this one request down (bad frame, another client has control, daemon queue full) but the handle is fine
+static bool device_error_keeps_handle(int err) {
+    return err == EINVAL || err == EBUSY || err == EAGAIN;
+}
+
+//closes the handle if there is one, the next call opens a new one (lock must be held)
+static void device_session_reset(struct device_session *session) {
+    if (session->fd >= 0) {
+        close(session->fd);
+        session->fd = -1;
+    }
+}
+
+//drops a handle that has gone bad (lock must be held)
+static void device_session_lose(struct device_session *session) {
+    device_session_reset(session);
+    session->lost = true;
+}
+
+void device_session_use(struct device_session *session, const struct device_ops *ops, void *target) {
+    pthread_mutex_lock(&session->lock);
+    device_session_reset(session);
+    session->lost = false;
+    session->ops = ops;
+    session->target = target;
+    pthread_mutex_unlock(&session->lock);
+}
+
+/**
+ * Writes to the device, reopening it once if the current handle has gone bad
+ * (e.g. the arm was unplugged and plugged back in).
+ * @return bytes written, or -1 on failure.
+ */
+ssize_t device_session_write(struct device_session *session, const void *buf, size_t len) {
+    ssize_t result = -1;
+    pthread_mutex_lock(&session->lock);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (device_session_ensure_open(session) < 0) break;
+        result = session->ops->write(session->fd, buf, len);
+        if (result >= 0) break;
+        const int err = errno;
+        perror("Error writing to device file");
+        metrics_add(METRIC_DEVICE_WRITE_ERRORS, 1);
+        if (device_error_keeps_handle(err)) break;
+        device_session_lose(session);
+    }
+    pthread_mutex_unlock(&session->lock);
+    return result;
+}
+
+//same as device_session_write but for reads
+ssize_t device_session_read(struct device_session *session, void *buf, size_t len) {
+    ssize_t result = -1;
+    pthread_mutex_lock(&session->lock);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (device_session_ensure_open(session) < 0) break;
+        result = session->ops->read(session->fd, buf, len);
+        if (result >= 0) break;
+        const int err = errno;
+        perror("Error reading from device file");
+        metrics_add(METRIC_DEVICE_READ_ERRORS, 1);
+        if (device_error_keeps_handle(err)) break;
+        device_session_lose(session);
+    }
+    pthread_mutex_unlock(&session->lock);
+    return result;
+}
+
+//same as device_session_write but for ioctl commands
+int device_session_ioctl(struct device_session *session, unsigned long request, void *arg) {
+    int result = -1;
+    pthread_mutex_lock(&session->lock);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (device_session_ensure_open(session) < 0) break;
+        result = session->ops->ioctl(session->fd, request, arg);
+        if (result != -1) break;
+        const int err = errno;
+        perror("ioctl failed");
+        metrics_add(METRIC_DEVICE_IOCTL_ERRORS, 1);
+        if (device_error_keeps_handle(err)) break;
+        device_session_lose(session);
+    }
+    pthread_mutex_unlock(&session->lock);
+    return result;
+}
+
+void device_session_close(struct device_session *session) {
+    pthread_mutex_lock(&session->lock);
+    device_session_reset(session);
+    pthread_mutex_unlock(&session->lock);
+}
@@ -0,0 +1,59 @@
+#ifndef ARM_DEVICE_H
+#define ARM_DEVICE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+// Path to robot arm
+#define DEVICE_PATH "/dev/A37JN_Robot_arm"
+#define MAGIC_NUM 0x80
+#define IOCTL_SET_VALUE _IOW(MAGIC_NUM, 1, struct device_command)
+
+struct device_command {
+    int var1;
+    int var2;
+    int var3;
+};
+
+/*
+ * How a session reaches the arm. device_node_ops goes to the driver's device
+ * file; mock_arm.c has a stand-in for running without the hardware. Each call
+ * gets the fd open() returned and reports errors through errno like the
+ * syscall it replaces.
+ */
+struct device_ops {
+    int (*open)(void *target);
+    ssize_t (*write)(int fd, const void *buf, size_t len);
+    ssize_t (*read)(int fd, void *buf, size_t len);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+};
+
+extern const struct device_ops device_node_ops;
+
+/*
+ * Persistent handle to the robot arm. The device is opened once and shared by
+ * every write, read and ioctl instead of being opened and released per command.
+ * The lock is needed because the writer thread and the status poller share it.
+ */
+struct device_session {
+    int fd;
+    pthread_mutex_t lock;
+    const struct device_ops *ops;
+    void *target;  // handed to ops->open: the device path, or the mock arm
+    bool lost;     // the handle was dropped after an error, so the next open is a reconnect
+};
+
+#define DEVICE_SESSION_INIT { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, \
+                              .ops = &device_node_ops, .target = (void *) DEVICE_PATH }
+
+//switches the session to another backend, closing whatever it had open
+void device_session_use(struct device_session *session, const struct device_ops *ops, void *target);
+
+ssize_t device_session_write(struct device_session *session, const void *buf, size_t len);
+ssize_t device_session_read(struct device_session *session, void *buf, size_t len);
+int device_session_ioctl(struct device_session *session, unsigned long request, void *arg);
+void device_session_close(struct device_session *session);
+
+#endif
@@ -0,0 +1,738 @@
+#include "arm_dispatcher.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arm_latency.h"
+#include "arm_metrics.h"
+#include "arm_record.h"
+#include "arm_time.h"
+#include "arm_trace.h"
+
+_Static_assert((COMMAND_QUEUE_SIZE & (COMMAND_QUEUE_SIZE - 1)) == 0, "COMMAND_QUEUE_SIZE must be a power of two");
+
+//ring the calling thread produces into, set once per thread by command_dispatcher_bind_producer
+static _Thread_local struct command_ring *producer_ring;
+
+void tick_histogram_add(struct tick_histogram *h, long long us) {
+    if (us < 0) us = 0;
+    int bucket = 0;
+    while (bucket < TICK_HISTOGRAM_BUCKETS - 1 && us >= (1LL << bucket)) {
+        bucket++;
+    }
+    h->counts[bucket]++;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+}
+
+void tick_histogram_print(FILE *out, const char *name, const struct tick_histogram *h) {
+    fprintf(out, "%s (max %lld us):", name, h->max_us);
+    for (int i = 0; i < TICK_HISTOGRAM_BUCKETS; i++) {
+        if (h->counts[i] == 0) continue;
+        if (i == 0) {
+            fprintf(out, " <1us=%lu", h->counts[i]);
+        } else if (i == TICK_HISTOGRAM_BUCKETS - 1) {
+            fprintf(out, " >=%lldus=%lu", 1LL << (i - 1), h->counts[i]);
+        } else {
+            fprintf(out, " <%lldus=%lu", 1LL << i, h->counts[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+void command_dispatcher_bind_producer(struct command_dispatcher *d, enum input_source source) {
+    producer_ring = &d->rings[source];
+}
+
+int command_dispatcher_enqueue(struct command_dispatcher *d, const struct queued_command *cmd) {
+    return command_dispatcher_enqueue_at(d, cmd, monotonic_ns());
+}
+
+int command_dispatcher_enqueue_at(struct command_dispatcher *d, const struct queued_command *cmd, long long enqueued_ns) {
+    struct command_ring *ring = producer_ring;
+    if (ring == NULL) {
+        fprintf(stderr, "Command queued from a thread with no input source\n");
+        return -1;
+    }
+
+    const unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == COMMAND_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        return -1;
+    }
+    struct queued_command *slot = &ring->slots[tail & (COMMAND_QUEUE_SIZE - 1)];
+    *slot = *cmd;
+    slot->stamps.enqueued_ns = enqueued_ns;
+    const long long input_ns = latency_input_ns();
+    slot->stamps.input_ns = input_ns != 0 ? input_ns : slot->stamps.enqueued_ns;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    latency_record(LATENCY_INPUT_TO_ENQUEUE, slot->stamps.enqueued_ns - slot->stamps.input_ns);
+
+    atomic_fetch_add_explicit(&ring->enqueued, 1, memory_order_relaxed);
+    const unsigned int depth = tail + 1 - head;
+    if (depth > atomic_load_explicit(&ring->max_depth, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->max_depth, depth, memory_order_relaxed);
+    }
+
+    // Pairs with the writer setting writer_sleeping before it re-checks the rings
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&d->writer_sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&d->lock);
+        pthread_cond_signal(&d->not_empty);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return 0;
+}
+
+void command_dispatcher_request_stop(struct command_dispatcher *d, unsigned int lane) {
+    const long long now_ns = monotonic_ns();
+    if (lane & STOP_LANE_ALL) {
+        atomic_store_explicit(&d->stop_all_asked_ns, now_ns, memory_order_relaxed);
+    }
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (lane & (1u << joint)) {
+            atomic_store_explicit(&d->stop_asked_ns[joint], now_ns, memory_order_relaxed);
+        }
+    }
+    // The oldest request not yet taken, for the latency; stops asked for meanwhile go out with it
+    long long none = 0;
+    atomic_compare_exchange_strong(&d->lane_asked_ns, &none, now_ns);
+    // Release, so the writer that sees the bits sees the times
+    atomic_fetch_or_explicit(&d->stop_lane, lane, memory_order_release);
+
+    // Pairs with the writer setting writer_sleeping before it re-checks
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&d->writer_sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&d->lock);
+        pthread_cond_signal(&d->not_empty);
+        pthread_mutex_unlock(&d->lock);
+    }
+}
+
+//next command to send, taking rings in turn so one busy source can't starve another (writer only)
+static const struct queued_command* command_dispatcher_peek(struct command_dispatcher *d, struct command_ring **from) {
+    for (unsigned int i = 0; i < SOURCE_COUNT; i++) {
+        struct command_ring *ring = &d->rings[(d->next_ring + i) % SOURCE_COUNT];
+        const unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (atomic_load_explicit(&ring->tail, memory_order_acquire) != head) {
+            *from = ring;
+            return &ring->slots[head & (COMMAND_QUEUE_SIZE - 1)];
+        }
+    }
+    return NULL;
+}
+
+//removes the command peek just returned (writer only)
+static struct queued_command command_dispatcher_pop(struct command_dispatcher *d, struct command_ring *ring) {
+    const unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const struct queued_command cmd = ring->slots[head & (COMMAND_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    d->next_ring = (unsigned int) (ring - d->rings + 1) % SOURCE_COUNT;
+    return cmd;
+}
+
+//nothing queued and no stop asked for
+static bool command_dispatcher_empty(struct command_dispatcher *d) {
+    struct command_ring *ring;
+    return atomic_load_explicit(&d->stop_lane, memory_order_relaxed) == 0
+           && command_dispatcher_peek(d, &ring) == NULL;
+}
+
+enum writer_wait {
+    WAIT_READY,    // something was queued
+    WAIT_TIMEOUT,  // deadline passed with nothing queued
+    WAIT_STOPPED   // stop was requested and every ring is empty
+};
+
+/**
+ * Parks the writer until a command is queued, the deadline passes or stop is requested.
+ * @param deadline: absolute monotonic time, or NULL to wait as long as it takes.
+ */
+static enum writer_wait command_dispatcher_wait(struct command_dispatcher *d, const struct timespec *deadline) {
+    enum writer_wait result = WAIT_READY;
+
+    pthread_mutex_lock(&d->lock);
+    atomic_store(&d->writer_sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (command_dispatcher_empty(d)) {
+        if (!d->running) {
+            result = WAIT_STOPPED;
+            break;
+        }
+        if (deadline == NULL) {
+            pthread_cond_wait(&d->not_empty, &d->lock);
+        } else if (pthread_cond_timedwait(&d->not_empty, &d->lock, deadline) == ETIMEDOUT) {
+            result = command_dispatcher_empty(d) ? WAIT_TIMEOUT : WAIT_READY;
+            break;
+        }
+    }
+    atomic_store(&d->writer_sleeping, false);
+    pthread_mutex_unlock(&d->lock);
+    return result;
+}
+
+//every write() to the arm goes through here so the recorder sees it
+static bool command_writer_write(struct command_dispatcher *d, const char *text, size_t len) {
+    const long long sent_ns = monotonic_ns();
+    if (device_session_write(d->session, text, len) == -1) {
+        TRACE_ERROR(TRACE_DEVICE_ERROR, errno, 0);
+        return false;
+    }
+    metrics_observe(METRIC_DEVICE_CALL, monotonic_ns() - sent_ns);
+    TRACE_TEXT_AT(TRACE_LEVEL_DEBUG, TRACE_DEVICE_WRITE, text, len);
+    if (d->config.recorder != NULL) {
+        command_recorder_text(d->config.recorder, sent_ns, text, len);
+    }
+    return true;
+}
+
+//and every ioctl frame
+static bool command_writer_ioctl(struct command_dispatcher *d, const struct device_command *frame) {
+    const long long sent_ns = monotonic_ns();
+    struct device_command arg = *frame;
+    if (device_session_ioctl(d->session, IOCTL_SET_VALUE, &arg) == -1) {
+        TRACE_ERROR(TRACE_DEVICE_ERROR, errno, 1);
+        return false;
+    }
+    metrics_observe(METRIC_DEVICE_CALL, monotonic_ns() - sent_ns);
+    TRACE_DEBUG(TRACE_DEVICE_IOCTL, frame->var1, frame->var2, frame->var3);
+    if (d->config.recorder != NULL) {
+        command_recorder_frame(d->config.recorder, sent_ns, frame);
+    }
+    return true;
+}
+
+//counts a change written to each joint in mask
+static void metrics_count_joints(unsigned int mask) {
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (mask & (1u << joint)) metrics_add(METRIC_JOINT_COMMANDS + joint, 1);
+    }
+}
+
+//sends a text or raw ioctl command on the writer thread
+static bool command_writer_send(struct command_dispatcher *d, const struct queued_command *cmd) {
+    if (cmd->kind == COMMAND_TEXT) {
+        const size_t len = strlen(cmd->text);
+        if (!command_writer_write(d, cmd->text, len)) return false;
+        enum joint joint;
+        enum joint_direction direction;
+        if (parse_joint_command(cmd->text, len, &joint, &direction) == 0) {
+            metrics_count_joints(1u << joint);
+        }
+        return true;
+    }
+
+    if (!command_writer_ioctl(d, &cmd->raw)) {
+        if (d->config.command_failed != NULL) {
+            d->config.command_failed(d->config.data);
+        }
+        return false;
+    }
+    unsigned int changed = 0;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (decode_joint(&cmd->raw, joint) != decode_joint(&d->motion, joint)) changed |= 1u << joint;
+    }
+    metrics_count_joints(changed);
+    d->motion = cmd->raw;
+    return true;
+}
+
+static bool is_motion_command(const struct queued_command *cmd) {
+    return cmd->kind == COMMAND_JOINT;
+}
+
+//a change to joint queued at queued_ns that a stop has been asked for since (LED changes only by name)
+bool command_dispatcher_overtaken(struct command_dispatcher *d, enum joint joint, long long queued_ns) {
+    if (queued_ns <= atomic_load_explicit(&d->stop_asked_ns[joint], memory_order_relaxed)) {
+        return true;
+    }
+    return joint != JOINT_LED && queued_ns <= atomic_load_explicit(&d->stop_all_asked_ns, memory_order_relaxed);
+}
+
+//a queued command that would undo a stop asked for after it, and so is dropped (writer only)
+static bool command_overtaken(struct command_dispatcher *d, const struct queued_command *cmd) {
+    const long long queued_ns = cmd->stamps.enqueued_ns;
+    if (cmd->kind == COMMAND_JOINT) {
+        return command_dispatcher_overtaken(d, cmd->joint, queued_ns);
+    }
+    if (queued_ns > atomic_load_explicit(&d->stop_all_asked_ns, memory_order_relaxed)) {
+        return false;
+    }
+    if (cmd->kind == COMMAND_IOCTL) {
+        return frame_is_moving(&cmd->raw);
+    }
+    enum joint joint;
+    enum joint_direction direction;
+    return parse_joint_command(cmd->text, strlen(cmd->text), &joint, &direction) == 0
+           && joint != JOINT_LED && direction != JOINT_STOP;
+}
+
+//when the stops in lane were asked for, for the latency (writer only, after taking lane)
+static long long command_writer_stops_asked(struct command_dispatcher *d, unsigned int lane) {
+    const long long oldest_ns = atomic_exchange_explicit(&d->lane_asked_ns, 0, memory_order_relaxed);
+    if (oldest_ns != 0) return oldest_ns;
+
+    // Asked for while the last stops were being taken, so their time went with those: use the earliest joint's
+    long long asked_ns = lane & STOP_LANE_ALL ? atomic_load_explicit(&d->stop_all_asked_ns, memory_order_relaxed) : 0;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (!(lane & (1u << joint))) continue;
+        const long long joint_ns = atomic_load_explicit(&d->stop_asked_ns[joint], memory_order_relaxed);
+        if (joint_ns != 0 && (asked_ns == 0 || joint_ns < asked_ns)) {
+            asked_ns = joint_ns;
+        }
+    }
+    return asked_ns;
+}
+
+//sends every stop asked for since last time, ahead of the queue (writer only)
+static void command_writer_stops(struct command_dispatcher *d) {
+    const unsigned int lane = atomic_exchange_explicit(&d->stop_lane, 0, memory_order_acquire);
+    if (lane == 0) return;
+    const long long asked_ns = command_writer_stops_asked(d, lane);
+
+    // Sent even if the arm should already be stopped: a stop is worth repeating
+    bool ok = true;
+    if (d->config.transport == TRANSPORT_IOCTL) {
+        struct device_command frame = d->motion;
+        if (lane & STOP_LANE_ALL) {
+            encode_stop_all(&frame);
+        }
+        for (int joint = 0; joint < JOINT_COUNT; joint++) {
+            if (lane & (1u << joint)) encode_joint(&frame, joint, JOINT_STOP);
+        }
+        ok = command_writer_ioctl(d, &frame);
+        if (ok) {
+            d->motion = frame;
+            metrics_count_joints(lane & STOP_LANE_ALL ? ~(1u << JOINT_LED) : lane);
+        } else if (d->config.command_failed != NULL) {
+            d->config.command_failed(d->config.data);
+        }
+    } else if (lane & STOP_LANE_ALL) {
+        ok = command_writer_write(d, "stop:all", strlen("stop:all"));
+        if (ok) {
+            encode_stop_all(&d->motion);
+            metrics_count_joints(~(1u << JOINT_LED));
+        }
+    } else {
+        for (int joint = 0; joint < JOINT_COUNT && ok; joint++) {
+            if (!(lane & (1u << joint))) continue;
+            const char *text = joint_encodings[joint].text[JOINT_STOP];
+            ok = command_writer_write(d, text, strlen(text));
+            if (ok) {
+                encode_joint(&d->motion, joint, JOINT_STOP);
+                metrics_count_joints(1u << joint);
+            }
+        }
+    }
+
+    // Stops are never held back, but they use up the link's tokens like anything else
+    unsigned int calls = 1;
+    if (d->config.transport == TRANSPORT_TEXT && !(lane & STOP_LANE_ALL)) {
+        calls = (unsigned int) __builtin_popcount(lane);
+    }
+    token_bucket_charge(&d->link_bucket, monotonic_ns(), calls);
+
+    if (!ok) {
+        atomic_fetch_add_explicit(&d->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    const long long waited_ns = asked_ns != 0 ? monotonic_ns() - asked_ns : 0;
+    if (asked_ns != 0) {
+        latency_record(LATENCY_STOP_TO_WRITE, waited_ns);
+    }
+    TRACE_INFO(TRACE_STOP_WRITTEN, lane, (uint32_t) (waited_ns / 1000));
+    if (d->config.poller != NULL) {
+        status_poller_note_command(d->config.poller, frame_is_moving(&d->motion));
+    }
+    atomic_fetch_add_explicit(&d->stops, 1, memory_order_relaxed);
+}
+
+//joint changes gathered during one coalescing window, with any the limiter held back from earlier ones
+struct motion_batch {
+    unsigned int changed;                         // bit per joint with a change to send
+    unsigned int held;                            // of those, changes a flush already held back
+    enum joint_direction direction[JOINT_COUNT];  // each one's latest
+    long long queued_ns[JOINT_COUNT];             // and when it was queued
+    unsigned int commands[JOINT_COUNT];           // commands folded into it
+    unsigned int stamped;                         // commands with latency stamps kept (the rest go unmeasured)
+    struct {
+        struct command_stamps stamps;
+        enum joint joint;
+    } stamps[COMMAND_QUEUE_SIZE];
+};
+
+//starts an empty batch (the arrays are left uninitialised on purpose, changed says what's set)
+static void motion_batch_start(struct motion_batch *batch) {
+    batch->changed = 0;
+    batch->held = 0;
+    batch->stamped = 0;
+}
+
+static void motion_batch_add(struct command_dispatcher *d, struct motion_batch *batch, const struct queued_command *cmd) {
+    const unsigned int bit = 1u << cmd->joint;
+    if (batch->stamped < COMMAND_QUEUE_SIZE) {
+        batch->stamps[batch->stamped].stamps = cmd->stamps;
+        batch->stamps[batch->stamped++].joint = cmd->joint;
+    }
+    if (batch->held & bit) {
+        // Superseded while waiting for a token, so it never goes out
+        atomic_fetch_add_explicit(&d->merged, 1, memory_order_relaxed);
+    } else if (!(batch->changed & bit)) {
+        batch->commands[cmd->joint] = 0;
+    }
+    batch->changed |= bit;
+    batch->direction[cmd->joint] = cmd->direction;
+    batch->queued_ns[cmd->joint] = cmd->stamps.enqueued_ns;
+    batch->commands[cmd->joint]++;
+}
+
+//updates counters, latency and the poller once a command or batch has been sent
+static void command_writer_account(struct command_dispatcher *d, bool ok, unsigned long count,
+                                   const struct command_stamps *stamps, unsigned int stamped) {
+    if (ok) {
+        const long long written_ns = monotonic_ns();
+        for (unsigned int i = 0; i < stamped; i++) {
+            latency_record(LATENCY_ENQUEUE_TO_WRITE, written_ns - stamps[i].enqueued_ns);
+            latency_record(LATENCY_INPUT_TO_WRITE, written_ns - stamps[i].input_ns);
+        }
+        if (d->config.poller != NULL) {
+            status_poller_note_command(d->config.poller, frame_is_moving(&d->motion));
+        }
+        atomic_fetch_add_explicit(&d->written, count, memory_order_relaxed);
+        atomic_fetch_add_explicit(&d->coalesced, count - 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&d->dropped, count, memory_order_relaxed);
+    }
+}
+
+//accounts for the joints in done and takes them out of the batch
+static void motion_batch_finish(struct command_dispatcher *d, struct motion_batch *batch, bool ok, unsigned int done) {
+    unsigned long count = 0;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (done & (1u << joint)) count += batch->commands[joint];
+    }
+
+    struct command_stamps stamps[COMMAND_QUEUE_SIZE];
+    unsigned int stamped = 0;
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < batch->stamped; i++) {
+        if (done & (1u << batch->stamps[i].joint)) {
+            stamps[stamped++] = batch->stamps[i].stamps;
+        } else {
+            batch->stamps[kept++] = batch->stamps[i];
+        }
+    }
+    batch->stamped = kept;
+    batch->changed &= ~done;
+    batch->held = batch->changed;
+
+    if (count > 0) {
+        command_writer_account(d, ok, count, stamps, stamped);
+    }
+}
+
+/**
+ * Sends a batch as one ioctl frame, or for the text transport as one string per
+ * joint that actually changed. Stops asked for meanwhile go first, and the
+ * changes they overtook are left out. A batch that changes nothing is not sent.
+ * With --limit, changes there are no tokens for stay in the batch for the next
+ * flush, where anything queued for the same joint meanwhile replaces them.
+ */
+static void command_writer_flush(struct command_dispatcher *d, struct motion_batch *batch) {
+    command_writer_stops(d);
+
+    const bool ioctl = d->config.transport == TRANSPORT_IOCTL;
+    const long long now_ns = monotonic_ns();
+    unsigned int link_tokens = token_bucket_available(&d->link_bucket, now_ns);
+    struct device_command frame = d->motion;
+    unsigned int done = 0;     // joints leaving the batch
+    unsigned int sending = 0;  // of those, the ones that change
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        const unsigned int bit = 1u << joint;
+        if (!(batch->changed & bit)) continue;
+        if (command_dispatcher_overtaken(d, joint, batch->queued_ns[joint])) {
+            atomic_fetch_add_explicit(&d->cancelled, 1, memory_order_relaxed);
+            done |= bit;
+            continue;
+        }
+        const enum joint_direction direction = batch->direction[joint];
+        if (direction == decode_joint(&d->motion, joint)) {
+            done |= bit;
+            continue;
+        }
+        // A frame is one call however many joints it carries, text is one per joint
+        const unsigned int cost = ioctl ? sending == 0 : 1;
+        if (link_tokens < cost || !token_bucket_take(&d->joint_buckets[joint], now_ns, 1)) continue;
+        link_tokens -= cost;
+        encode_joint(&frame, joint, direction);
+        done |= bit;
+        sending |= bit;
+    }
+
+    bool ok = true;
+    if (sending != 0 && ioctl) {
+        token_bucket_take(&d->link_bucket, now_ns, 1);
+        ok = command_writer_ioctl(d, &frame);
+        if (ok) {
+            d->motion = frame;
+            metrics_count_joints(sending);
+        }
+    } else if (sending != 0) {
+        for (int joint = 0; joint < JOINT_COUNT && ok; joint++) {
+            if (!(sending & (1u << joint))) continue;
+            const enum joint_direction direction = decode_joint(&frame, joint);
+            const char *text = joint_encodings[joint].text[direction];
+            token_bucket_take(&d->link_bucket, now_ns, 1);
+            ok = command_writer_write(d, text, strlen(text));
+            if (ok) {
+                encode_joint(&d->motion, joint, direction);
+                metrics_count_joints(1u << joint);
+            }
+        }
+    }
+
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (sending & batch->held & (1u << joint)) {
+            atomic_fetch_add_explicit(&d->delayed, 1, memory_order_relaxed);
+        }
+    }
+    motion_batch_finish(d, batch, ok, done);
+    if (batch->changed != 0) {
+        TRACE_DEBUG(TRACE_LIMIT_HELD, batch->changed);
+    }
+}
+
+//when the limiter will next let a held change through (writer only)
+static long long motion_batch_ready_ns(struct command_dispatcher *d, const struct motion_batch *batch) {
+    long long ready_ns = LLONG_MAX;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (!(batch->changed & (1u << joint))) continue;
+        const long long joint_ns = token_bucket_ready_ns(&d->joint_buckets[joint], 1);
+        if (joint_ns < ready_ns) ready_ns = joint_ns;
+    }
+    const long long link_ns = token_bucket_ready_ns(&d->link_bucket, 1);
+    return link_ns > ready_ns ? link_ns : ready_ns;
+}
+
+/*
+ * Text and raw frames go out if the link has a token, and are refused if not:
+ * unlike joint changes there is nothing to merge them into, and holding one
+ * would hold up everything queued behind it. A raw frame sets every joint, so
+ * changes still held back from before it are dropped rather than sent after it.
+ */
+static void command_writer_send_limited(struct command_dispatcher *d, struct motion_batch *batch,
+                                        const struct queued_command *cmd) {
+    if (!token_bucket_take(&d->link_bucket, monotonic_ns(), 1)) {
+        atomic_fetch_add_explicit(&d->rejected, 1, memory_order_relaxed);
+        TRACE_INFO(TRACE_LIMIT_REJECTED, cmd->kind);
+        return;
+    }
+    const bool ok = command_writer_send(d, cmd);
+    command_writer_account(d, ok, 1, &cmd->stamps, 1);
+    if (ok && cmd->kind == COMMAND_IOCTL && batch->changed != 0) {
+        for (int joint = 0; joint < JOINT_COUNT; joint++) {
+            if (batch->changed & (1u << joint)) {
+                atomic_fetch_add_explicit(&d->merged, 1, memory_order_relaxed);
+            }
+        }
+        motion_batch_finish(d, batch, true, batch->changed);
+    }
+}
+
+//event driven writer: wakes for each command and coalesces for MOTION_COALESCE_US
+static void command_writer_run_events(struct command_dispatcher *d) {
+    struct command_ring *ring;
+    struct motion_batch batch;
+    motion_batch_start(&batch);
+
+    // Keeps going after stop is requested until the rings are empty so final stop commands still reach the arm
+    for (;;) {
+        command_writer_stops(d);
+        if (command_dispatcher_peek(d, &ring) == NULL) {
+            if (batch.changed == 0) {
+                if (command_dispatcher_wait(d, NULL) == WAIT_STOPPED) break;
+                continue;
+            }
+            // Changes held back by the limiter go when there are tokens, or with the next command
+            const struct timespec ready = ns_timespec(motion_batch_ready_ns(d, &batch));
+            const enum writer_wait result = command_dispatcher_wait(d, &ready);
+            if (result == WAIT_STOPPED) {
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ready, NULL) == EINTR) {
+                }
+            }
+            if (result != WAIT_READY) {
+                command_writer_flush(d, &batch);
+            }
+            continue;
+        }
+        const struct queued_command cmd = command_dispatcher_pop(d, ring);
+        if (command_overtaken(d, &cmd)) {
+            atomic_fetch_add_explicit(&d->cancelled, 1, memory_order_relaxed);
+            continue;
+        }
+
+        if (!is_motion_command(&cmd)) {
+            command_writer_send_limited(d, &batch, &cmd);
+            continue;
+        }
+        motion_batch_add(d, &batch, &cmd);
+
+        // Fold in every joint change that shows up before the window closes, or a stop is asked for
+        struct timespec deadline;
+        deadline_after_us(&deadline, MOTION_COALESCE_US);
+        for (;;) {
+            if (atomic_load_explicit(&d->stop_lane, memory_order_relaxed) != 0) break;
+            const struct queued_command *next = command_dispatcher_peek(d, &ring);
+            if (next != NULL) {
+                if (!is_motion_command(next)) break;
+                const struct queued_command popped = command_dispatcher_pop(d, ring);
+                if (command_overtaken(d, &popped)) {
+                    atomic_fetch_add_explicit(&d->cancelled, 1, memory_order_relaxed);
+                    continue;
+                }
+                motion_batch_add(d, &batch, &popped);
+                continue;
+            }
+            if (MOTION_COALESCE_US == 0 || command_dispatcher_wait(d, &deadline) != WAIT_READY) break;
+        }
+
+        command_writer_flush(d, &batch);
+    }
+}
+
+//one control tick: everything queued since the last tick, joint changes folded into one frame
+static void command_writer_tick(struct command_dispatcher *d, struct motion_batch *batch) {
+    struct command_ring *ring;
+
+    command_writer_stops(d);
+    while (command_dispatcher_peek(d, &ring) != NULL) {
+        const struct queued_command cmd = command_dispatcher_pop(d, ring);
+        if (command_overtaken(d, &cmd)) {
+            atomic_fetch_add_explicit(&d->cancelled, 1, memory_order_relaxed);
+            continue;
+        }
+        if (is_motion_command(&cmd)) {
+            motion_batch_add(d, batch, &cmd);
+            continue;
+        }
+        // Keep ordering: joint changes queued before a raw command go out before it
+        if (batch->changed != 0) {
+            command_writer_flush(d, batch);
+        }
+        command_writer_send_limited(d, batch, &cmd);
+    }
+    if (batch->changed != 0) {
+        command_writer_flush(d, batch);
+    }
+}
+
+//fixed-rate writer: sleeps to absolute tick deadlines and records how well it keeps to them
+static void command_writer_run_ticks(struct command_dispatcher *d) {
+    struct control_loop_stats *stats = &d->loop_stats;
+    const long long period_ns = 1000000000LL / d->config.rate_hz;
+    struct motion_batch batch;
+    motion_batch_start(&batch);
+
+    if (d->config.realtime) {
+        const struct sched_param param = { .sched_priority = CONTROL_RT_PRIORITY };
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "Could not switch control loop to SCHED_FIFO: %s\n", strerror(err));
+        }
+    }
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (;;) {
+        timespec_add_ns(&next, period_ns);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+        const long long tick_ns = timespec_ns(&next);
+        tick_histogram_add(&stats->jitter, (monotonic_ns() - tick_ns) / 1000);
+        stats->ticks++;
+
+        // Read before draining so nothing queued ahead of the stop request is left behind
+        const bool stopping = !atomic_load(&d->running);
+        command_writer_tick(d, &batch);
+        if (stopping && command_dispatcher_empty(d) && batch.changed == 0) break;
+
+        // Ran into the next tick: record it and skip the ticks we've already missed
+        const long long late_ns = monotonic_ns() - (tick_ns + period_ns);
+        if (late_ns > 0) {
+            const long long missed = late_ns / period_ns + 1;
+            stats->overruns++;
+            stats->missed_ticks += missed;
+            tick_histogram_add(&stats->overrun, late_ns / 1000);
+            timespec_add_ns(&next, missed * period_ns);
+        }
+    }
+}
+
+static void* command_writer(void *arg) {
+    struct command_dispatcher *d = arg;
+    trace_name_thread("writer");
+
+    if (d->config.rate_hz > 0) {
+        command_writer_run_ticks(d);
+    } else {
+        command_writer_run_events(d);
+    }
+    return NULL;
+}
+
+int command_dispatcher_start(struct command_dispatcher *d, struct device_session *session,
+                             const struct dispatcher_config *config) {
+    monotonic_cond_init(&d->not_empty);
+    d->session = session;
+    d->config = *config;
+    // Per-joint limits only apply under a link limit
+    const struct rate_limit_config *limit = &config->limit;
+    token_bucket_init(&d->link_bucket, limit->link_hz, limit->burst);
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        token_bucket_init(&d->joint_buckets[joint], limit->link_hz > 0 ? limit->joint_hz : 0, limit->burst);
+    }
+    d->running = true;
+    if (pthread_create(&d->thread, NULL, command_writer, d) != 0) {
+        d->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+//asks the writer to finish what's queued and waits for it
+void command_dispatcher_stop(struct command_dispatcher *d) {
+    pthread_mutex_lock(&d->lock);
+    d->running = false;
+    pthread_cond_signal(&d->not_empty);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+}
+
+//snapshot of the counters, safe to call from any thread (the fields are read independently)
+void command_dispatcher_get_stats(struct command_dispatcher *d, struct dispatcher_stats *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < SOURCE_COUNT; i++) {
+        struct command_ring *ring = &d->rings[i];
+        out->depth += atomic_load(&ring->tail) - atomic_load(&ring->head);
+        const unsigned int max_depth = atomic_load(&ring->max_depth);
+        if (max_depth > out->max_depth) {
+            out->max_depth = max_depth;
+        }
+        out->enqueued += atomic_load(&ring->enqueued);
+        out->overflows += atomic_load(&ring->overflows);
+    }
+    out->written = atomic_load(&d->written);
+    out->dropped = atomic_load(&d->dropped);
+    out->coalesced = atomic_load(&d->coalesced);
+    out->stops = atomic_load(&d->stops);
+    out->cancelled = atomic_load(&d->cancelled);
+    out->merged = atomic_load(&d->merged);
+    out->delayed = atomic_load(&d->delayed);
+    out->rejected = atomic_load(&d->rejected);
+}
@@ -0,0 +1,197 @@
+#ifndef ARM_DISPATCHER_H
+#define ARM_DISPATCHER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arm_device.h"
+#include "arm_limit.h"
+#include "arm_protocol.h"
+#include "arm_status.h"
+
+/*
+ * Command dispatcher: every input source (buttons, keys, joystick, ioctl box)
+ * drops its command into a bounded queue and returns straight away. A single
+ * writer thread owns the device and works through the queue, so a slow USB
+ * transfer never blocks the GTK main loop or the joystick thread.
+ *
+ * Each producing thread has its own lock-free single-producer ring, so
+ * enqueueing never takes a lock. The mutex/condvar are only used to park the
+ * writer when every ring is empty.
+ */
+#define COMMAND_QUEUE_SIZE 64 // per ring, must be a power of two
+#define COMMAND_MAX_LEN 32
+
+/*
+ * Joint changes that arrive within this window of each other (a diagonal
+ * stick push, several keys held) are folded into one frame so the joints
+ * start together and the device sees one transaction. 0 turns it off.
+ */
+#define MOTION_COALESCE_US 4000
+
+enum command_kind {
+    COMMAND_TEXT,     // free-form string sent with write()
+    COMMAND_IOCTL,    // raw device_command sent with IOCTL_SET_VALUE
+    COMMAND_JOINT     // one joint change, sent on the configured transport
+};
+
+/*
+ * Priority lane for stops, beside the rings. Any thread, bound to a source or
+ * not, asks for joints to be stopped by setting their bits. The writer takes
+ * the whole mask before every command it sends, when a coalescing window or
+ * tick ends and whenever it is woken, and sends it ahead of everything queued:
+ * one frame on the ioctl transport, stop:all or a string per joint on the text
+ * one. stop:all needs no encoding, the motor bytes are just zeroed.
+ *
+ * A queued joint command that a stop was asked for after is dropped instead
+ * of undoing the stop; stop:all drops every queued move, raw frames and text
+ * included. Worst case from asking to the stop being written: the device call
+ * already in progress (the writer's, or the poller's status read), in text
+ * mode the rest of a flush (one write per joint), and in fixed-rate mode up to
+ * one tick. The "stop -> written" latency histogram measures it.
+ */
+#define STOP_LANE_ALL (1u << 31)
+
+struct command_stamps {
+    long long input_ns;     // input event picked up
+    long long enqueued_ns;  // placed in a ring
+};
+
+struct queued_command {
+    enum command_kind kind;
+    struct command_stamps stamps;  // filled in by command_dispatcher_enqueue
+    union {
+        char text[COMMAND_MAX_LEN];
+        struct device_command raw;
+        struct {
+            enum joint joint;
+            enum joint_direction direction;
+        };
+    };
+};
+
+//threads that queue commands, each gets its own ring
+enum input_source {
+    SOURCE_UI,        // GTK main loop: buttons, keys, ioctl box
+    SOURCE_JOYSTICK,  // joystick_listener
+    SOURCE_MOTION,    // motion scheduler pulses, see arm_motion.h
+    SOURCE_WATCHDOG,  // the dead-man stop, see arm_watchdog.h
+    SOURCE_COUNT
+};
+
+struct command_ring {
+    struct queued_command slots[COMMAND_QUEUE_SIZE];
+    atomic_uint head;             // next slot to read, only the writer moves it
+    atomic_uint tail;             // next slot to fill, only the producer moves it
+    atomic_uint max_depth;        // producer-side statistics
+    atomic_ulong enqueued;
+    atomic_ulong overflows;
+};
+
+struct dispatcher_stats {
+    unsigned int depth;           // commands currently waiting
+    unsigned int max_depth;       // high-water mark of the fullest ring
+    unsigned long enqueued;       // commands accepted into the queue
+    unsigned long written;        // commands the writer delivered to the device
+    unsigned long overflows;      // commands rejected because the queue was full
+    unsigned long dropped;        // commands the writer gave up on (device error)
+    unsigned long coalesced;      // joint commands folded into another command's frame
+    unsigned long stops;          // stops sent through the priority lane
+    unsigned long cancelled;      // queued moves dropped because a stop overtook them
+    unsigned long merged;         // joint changes held back by the limiter, then replaced by a later one
+    unsigned long delayed;        // joint changes held back by the limiter, then sent
+    unsigned long rejected;       // text and raw commands refused by the limiter
+};
+
+/*
+ * Optional fixed-rate control loop (rate_hz). Instead of waking per command,
+ * the writer wakes on an absolute clock_nanosleep tick, picks up everything
+ * queued since the last tick and sends it as one frame. With realtime it
+ * also runs SCHED_FIFO (the caller should mlockall) so the tick isn't held
+ * up by paging or by normal threads.
+ */
+#define CONTROL_RATE_MIN_HZ 100
+#define CONTROL_RATE_MAX_HZ 1000
+#define CONTROL_RT_PRIORITY 50
+#define TICK_HISTOGRAM_BUCKETS 16 // log2 microseconds: <1, <2, <4 ... <16384, the rest
+
+struct tick_histogram {
+    unsigned long counts[TICK_HISTOGRAM_BUCKETS];
+    long long max_us;
+};
+
+struct control_loop_stats {
+    unsigned long ticks;
+    unsigned long overruns;        // ticks whose work ran past the next tick
+    unsigned long missed_ticks;    // ticks skipped to catch up after an overrun
+    struct tick_histogram jitter;  // how late each tick woke up
+    struct tick_histogram overrun; // how far past the next tick an overrunning tick finished
+};
+
+struct command_recorder;
+
+struct dispatcher_config {
+    enum command_transport transport;
+    unsigned int rate_hz;           // 0 = writer wakes per command instead of on a tick
+    bool realtime;
+    struct status_poller *poller;   // told about every command that goes out, may be NULL
+    void (*command_failed)(void *data);  // a raw ioctl was refused, called on the writer thread; may be NULL
+    struct command_recorder *recorder;   // every command delivered to the arm is logged to it, may be NULL
+    struct rate_limit_config limit;      // link_hz 0 = no limit
+    void *data;
+};
+
+struct command_dispatcher {
+    struct command_ring rings[SOURCE_COUNT];
+    unsigned int next_ring;        // round-robin position, writer only
+    atomic_ulong written;          // writer-side statistics
+    atomic_ulong dropped;
+    atomic_ulong coalesced;
+    atomic_uint stop_lane;                    // joint bits to stop, STOP_LANE_ALL for stop:all
+    atomic_llong stop_asked_ns[JOINT_COUNT];  // when each joint was last asked to stop
+    atomic_llong stop_all_asked_ns;
+    atomic_llong lane_asked_ns;               // oldest stop not yet taken by the writer, 0 if none
+    atomic_ulong stops;
+    atomic_ulong cancelled;
+    atomic_ulong merged;
+    atomic_ulong delayed;
+    atomic_ulong rejected;
+    atomic_bool writer_sleeping;   // writer is (about to be) parked on not_empty
+    atomic_bool running;           // changed under lock so a parked writer can't miss it
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct device_session *session;
+    struct dispatcher_config config;
+    struct device_command motion;  // what every motor was last told, only touched by the writer
+    struct token_bucket link_bucket;                // config.limit, writer only
+    struct token_bucket joint_buckets[JOINT_COUNT];
+    struct control_loop_stats loop_stats;  // writer only, read after it has been joined
+};
+
+#define COMMAND_DISPATCHER_INIT { .lock = PTHREAD_MUTEX_INITIALIZER }
+
+int command_dispatcher_start(struct command_dispatcher *d, struct device_session *session,
+                             const struct dispatcher_config *config);
+void command_dispatcher_stop(struct command_dispatcher *d);
+
+//makes the calling thread the (only) producer for source's ring
+void command_dispatcher_bind_producer(struct command_dispatcher *d, enum input_source source);
+int command_dispatcher_enqueue(struct command_dispatcher *d, const struct queued_command *cmd);
+
+//as command_dispatcher_enqueue, stamped enqueued_ns (monotonic) instead of now, for a producer that took the time earlier
+int command_dispatcher_enqueue_at(struct command_dispatcher *d, const struct queued_command *cmd, long long enqueued_ns);
+
+//asks for the joints in lane (bit per joint, or STOP_LANE_ALL) to be stopped ahead of the queue; any thread, never fails
+void command_dispatcher_request_stop(struct command_dispatcher *d, unsigned int lane);
+
+//whether a change to joint queued at queued_ns will be dropped for a stop asked for since; any thread
+bool command_dispatcher_overtaken(struct command_dispatcher *d, enum joint joint, long long queued_ns);
+
+void command_dispatcher_get_stats(struct command_dispatcher *d, struct dispatcher_stats *out);
+void tick_histogram_add(struct tick_histogram *h, long long us);
+void tick_histogram_print(FILE *out, const char *name, const struct tick_histogram *h);
+
+#endif
@@ -0,0 +1,473 @@
+#include "arm_input.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arm_latency.h"
+#include "arm_metrics.h"
+#include "arm_trace.h"
+
+const struct input_map input_map_default = {
+    .keys = {
+        ['1'] = { true, JOINT_LED, JOINT_POS, RELEASE_NONE },
+        ['2'] = { true, JOINT_LED, JOINT_STOP, RELEASE_NONE },
+        ['k'] = { true, JOINT_BASE, JOINT_POS, RELEASE_STOP },
+        ['o'] = { true, JOINT_BASE, JOINT_NEG, RELEASE_STOP },
+        ['j'] = { true, JOINT_SHOULDER, JOINT_POS, RELEASE_STOP },
+        ['i'] = { true, JOINT_SHOULDER, JOINT_NEG, RELEASE_STOP },
+        ['f'] = { true, JOINT_ELBOW, JOINT_POS, RELEASE_STOP },
+        ['r'] = { true, JOINT_ELBOW, JOINT_NEG, RELEASE_STOP },
+        ['d'] = { true, JOINT_WRIST, JOINT_POS, RELEASE_STOP },
+        ['e'] = { true, JOINT_WRIST, JOINT_NEG, RELEASE_STOP },
+        ['s'] = { true, JOINT_CLAW, JOINT_POS, RELEASE_STOP },
+        ['w'] = { true, JOINT_CLAW, JOINT_NEG, RELEASE_STOP },
+        [27] = INPUT_ACTION_ESTOP,  // Escape, which can't be text in the command entry
+    },
+    .buttons = {
+        [0] = { true, JOINT_CLAW, JOINT_NEG, RELEASE_STOP },
+        [1] = { true, JOINT_CLAW, JOINT_POS, RELEASE_STOP },
+        [2] = { true, JOINT_WRIST, JOINT_NEG, RELEASE_STOP },
+        [3] = { true, JOINT_LED, JOINT_STOP, RELEASE_NONE },
+        [4] = { true, JOINT_WRIST, JOINT_POS, RELEASE_STOP },
+        [5] = { true, JOINT_LED, JOINT_POS, RELEASE_NONE },
+        [8] = INPUT_ACTION_ESTOP,
+    },
+    .axes = {
+        [1] = { true, JOINT_SHOULDER, JOINT_POS, AXIS_CALIBRATION_DEFAULT },
+        // The base needs a wider dead zone, and more of it on the left
+        [3] = { true, JOINT_BASE, JOINT_POS, { .center = 5000, .dead_zone = 25000 } },
+        [5] = { true, JOINT_ELBOW, JOINT_NEG, AXIS_CALIBRATION_DEFAULT },
+    },
+};
+
+static enum joint_direction opposite_direction(enum joint_direction direction) {
+    return direction == JOINT_POS ? JOINT_NEG : direction == JOINT_NEG ? JOINT_POS : JOINT_STOP;
+}
+
+//one "key 1 led:on latch" or "button 8 estop" style line, after the keyword and input number
+static int input_map_parse_action(const char *command, const char *mode, struct input_action *action) {
+    if (strcmp(command, "estop") == 0) {
+        *action = (struct input_action) INPUT_ACTION_ESTOP;
+        return mode[0] == '\0' ? 0 : -1;
+    }
+
+    enum joint joint;
+    enum joint_direction direction;
+    if (parse_joint_command(command, strlen(command), &joint, &direction) != 0) {
+        return -1;
+    }
+    if (mode[0] != '\0' && strcmp(mode, "latch") != 0) {
+        return -1;
+    }
+    *action = (struct input_action) {
+        .mapped = true,
+        .joint = joint,
+        .direction = direction,
+        .release = mode[0] != '\0' ? RELEASE_NONE : RELEASE_STOP,
+    };
+    return 0;
+}
+
+//a key is its character, or a number for anything that isn't printable
+static int input_map_parse_key(const char *text, unsigned int *key) {
+    if (text[0] != '\0' && text[1] == '\0') {
+        *key = (unsigned char) text[0];
+        return 0;
+    }
+    char *end;
+    *key = (unsigned int) strtoul(text, &end, 0);
+    return *end == '\0' && *key < INPUT_KEY_COUNT ? 0 : -1;
+}
+
+//"axis 3 base:right center=5000 deadzone=25000" style settings
+static int input_map_parse_axis(const char *command, char *settings, struct axis_action *axis) {
+    struct input_action action;
+    if (input_map_parse_action(command, "", &action) != 0 || action.direction == JOINT_STOP) {
+        return -1;
+    }
+
+    struct axis_calibration calibration = AXIS_CALIBRATION_DEFAULT;
+    char *save;
+    for (char *token = strtok_r(settings, " \t", &save); token != NULL; token = strtok_r(NULL, " \t", &save)) {
+        char name[16], end;
+        int value;
+        if (sscanf(token, "%15[a-z]=%d%c", name, &value, &end) != 2) {
+            return -1;
+        }
+        if (strcmp(name, "center") == 0) {
+            calibration.center = value;
+        } else if (strcmp(name, "deadzone") == 0) {
+            calibration.dead_zone = value;
+        } else if (strcmp(name, "hysteresis") == 0) {
+            calibration.hysteresis = value;
+        } else if (strcmp(name, "expo") == 0) {
+            calibration.expo = value;
+        } else {
+            return -1;
+        }
+    }
+    if (calibration.center < -32767 || calibration.center > 32767 || calibration.dead_zone < 0
+            || calibration.hysteresis < 0 || calibration.hysteresis > calibration.dead_zone
+            || calibration.expo < 0 || calibration.expo > 100) {
+        return -1;
+    }
+
+    *axis = (struct axis_action) {
+        .mapped = true,
+        .joint = action.joint,
+        .positive = action.direction,
+        .calibration = calibration,
+    };
+    return 0;
+}
+
+/**
+ * Loads a mapping file, which replaces the built-in mapping entirely, and
+ * compiles it. One binding per line, # starts a comment:
+ *   key CHAR JOINT:DIRECTION [latch]
+ *   button NUMBER JOINT:DIRECTION [latch]
+ *   key CHAR estop, button NUMBER estop
+ *   axis NUMBER JOINT:DIRECTION [center=N] [deadzone=N] [hysteresis=N] [expo=PERCENT]
+ * Keys and buttons move the joint while held and stop it when let go, unless
+ * latched. estop stops every motor on press, see arm_emergency_stop. An axis moves the joint in DIRECTION above center and the other way
+ * below, see struct axis_calibration.
+ * @return 0, or -1 (reported with the line number) if the file can't be read or has an error.
+ */
+int input_map_load(struct input_map *map, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Error opening input map");
+        return -1;
+    }
+    memset(map, 0, sizeof(*map));
+
+    char line[256];
+    int line_number = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        char kind[16], input[16], command[COMMAND_MAX_LEN], extra[16] = "";
+        const int fields = sscanf(line, "%15s %15s %31s %15s", kind, input, command, extra);
+        if (fields <= 0) {
+            continue;
+        }
+
+        unsigned int number;
+        if (fields >= 3 && strcmp(kind, "key") == 0 && input_map_parse_key(input, &number) == 0) {
+            result = input_map_parse_action(command, extra, &map->keys[number]);
+        } else if (fields >= 3 && strcmp(kind, "button") == 0 && sscanf(input, "%u", &number) == 1
+                   && number < INPUT_BUTTON_COUNT) {
+            result = input_map_parse_action(command, extra, &map->buttons[number]);
+        } else if (fields >= 3 && strcmp(kind, "axis") == 0 && sscanf(input, "%u", &number) == 1
+                   && number < INPUT_AXIS_COUNT) {
+            int settings = 0;
+            sscanf(line, "%*s %*s %*s%n", &settings);
+            result = input_map_parse_axis(command, line + settings, &map->axes[number]);
+        } else {
+            result = -1;
+        }
+        if (result != 0) {
+            fprintf(stderr, "%s:%d: not a valid binding\n", path, line_number);
+        }
+    }
+    fclose(file);
+    return result == 0 ? input_map_compile(map) : result;
+}
+
+//the built-in mapping, compiled
+int input_map_load_default(struct input_map *map) {
+    *map = input_map_default;
+    return input_map_compile(map);
+}
+
+//what the inputs do with one raw axis value, see AXIS_TABLE_SIZE
+static uint16_t axis_table_entry(const struct axis_action *axis, int value) {
+    const struct axis_calibration *calibration = &axis->calibration;
+    const int offset = value - calibration->center;
+    if (offset == 0) return 0;
+
+    const int distance = abs(offset);
+    const enum joint_direction side = offset > 0 ? axis->positive : opposite_direction(axis->positive);
+    uint16_t entry = 0;
+    if (distance >= calibration->dead_zone - calibration->hysteresis) {
+        entry |= (uint16_t) (side << 10) | 1;  // the lowest level while held in the hysteresis band
+    }
+    if (distance >= calibration->dead_zone) {
+        // How far into the travel left on this side, shaped by the expo curve
+        const int travel = (offset > 0 ? 32767 - calibration->center : 32768 + calibration->center)
+                           - calibration->dead_zone;
+        double x = travel > 0 ? (double) (distance - calibration->dead_zone) / travel : 1.0;
+        if (x > 1.0) x = 1.0;
+        const double expo = calibration->expo / 100.0;
+        const long level = lround(((1.0 - expo) * x + expo * x * x * x) * 255);
+        entry = (uint16_t) ((entry & ~0xFF) | side << 8 | (level > 0 ? level : 1));
+    }
+    return entry;
+}
+
+/**
+ * Builds the lookup table of every mapped axis from its calibration, in one
+ * allocation. 128 KiB per mapped axis.
+ * @return 0, or -1 (reported) if out of memory.
+ */
+int input_map_compile(struct input_map *map) {
+    size_t mapped = 0;
+    for (int i = 0; i < INPUT_AXIS_COUNT; i++) {
+        mapped += map->axes[i].mapped;
+    }
+    map->axis_tables = NULL;
+    if (mapped > 0) {
+        map->axis_tables = malloc(mapped * AXIS_TABLE_SIZE * sizeof(uint16_t));
+        if (map->axis_tables == NULL) {
+            perror("Error compiling input map");
+            return -1;
+        }
+    }
+
+    uint16_t *table = map->axis_tables;
+    for (int i = 0; i < INPUT_AXIS_COUNT; i++) {
+        struct axis_action *axis = &map->axes[i];
+        axis->table = NULL;
+        if (!axis->mapped) continue;
+        for (int value = -32768; value <= 32767; value++) {
+            table[(uint16_t) value] = axis_table_entry(axis, value);
+        }
+        axis->table = table;
+        table += AXIS_TABLE_SIZE;
+    }
+    return 0;
+}
+
+void input_map_free(struct input_map *map) {
+    free(map->axis_tables);
+    map->axis_tables = NULL;
+    for (int i = 0; i < INPUT_AXIS_COUNT; i++) {
+        map->axes[i].table = NULL;
+    }
+}
+
+static bool bitset_test(const uint64_t *bits, unsigned int i) {
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static void bitset_assign(uint64_t *bits, unsigned int i, bool value) {
+    if (value) {
+        bits[i / 64] |= (uint64_t) 1 << (i % 64);
+    } else {
+        bits[i / 64] &= ~((uint64_t) 1 << (i % 64));
+    }
+}
+
+//a GDK keyval as a key code: the control keys (Escape...) are their ASCII code plus 0xff00
+static unsigned int keyboard_key(unsigned int key) {
+    return key >= 0xff00 && key < 0xff20 ? key - 0xff00 : key;
+}
+
+/**
+ * Starts the joint bound to key moving, once per press however long the key auto-repeats.
+ * @param key: the key code; printable keys are their character ('k', '1'...), as GDK keyvals are.
+ */
+void keyboard_input_press(struct keyboard_input *keys, unsigned int key, struct arm_controller *arm) {
+    key = keyboard_key(key);
+    if (key >= INPUT_KEY_COUNT || bitset_test(keys->pressed, key)) return;
+    const struct input_action *action = &keys->map->keys[key];
+    if (!action->mapped) return;
+
+    bitset_assign(keys->pressed, key, true);
+    if (action->estop) {
+        arm_emergency_stop(arm);
+        return;
+    }
+    arm_send_joint(arm, action->joint, action->direction);
+}
+
+//stops the joint bound to key (latched keys only re-arm)
+void keyboard_input_release(struct keyboard_input *keys, unsigned int key, struct arm_controller *arm) {
+    key = keyboard_key(key);
+    if (key >= INPUT_KEY_COUNT || !bitset_test(keys->pressed, key)) return;
+    const struct input_action *action = &keys->map->keys[key];
+
+    bitset_assign(keys->pressed, key, false);
+    if (action->mapped && action->release == RELEASE_STOP) {
+        arm_send_joint(arm, action->joint, JOINT_STOP);
+    }
+}
+
+bool keyboard_input_emergency(const struct keyboard_input *keys, unsigned int key) {
+    key = keyboard_key(key);
+    return key < INPUT_KEY_COUNT && keys->map->keys[key].estop;
+}
+
+//every joint command from the pad goes through here so it can be counted
+static void joystick_send(struct joystick_input *pad, struct arm_controller *arm,
+                          enum joint joint, enum joint_direction direction) {
+    pad->stats.commands++;
+    arm_send_joint(arm, joint, direction);
+}
+
+static void joystick_button(struct joystick_input *pad, unsigned int number, bool down, struct arm_controller *arm) {
+    const struct input_action *action = number < INPUT_BUTTON_COUNT ? &pad->map->buttons[number] : NULL;
+    // Unmapped: joystick_input_handle has already traced the event
+    if (action == NULL || !action->mapped) return;
+
+    const uint32_t bit = 1u << number;
+    if (down == ((pad->buttons_pressed & bit) != 0)) return;
+    pad->buttons_pressed ^= bit;
+
+    if (action->estop) {
+        if (down) arm_emergency_stop(arm);
+    } else if (down) {
+        joystick_send(pad, arm, action->joint, action->direction);
+    } else if (action->release == RELEASE_STOP) {
+        joystick_send(pad, arm, action->joint, JOINT_STOP);
+    }
+}
+
+static void joystick_axis(struct joystick_input *pad, unsigned int number, int value, struct arm_controller *arm) {
+    if (number >= INPUT_AXIS_COUNT) return;
+    const struct axis_action *axis = &pad->map->axes[number];
+    if (!axis->mapped) return;
+
+    // Dead zone, offset and curve are all in the table; hysteresis is choosing
+    // the hold direction over the enter one while the joint is moving that way
+    const uint16_t entry = axis->table[(uint16_t) value];
+    const enum joint_direction current = pad->axis_direction[number];
+    const enum joint_direction direction = current != JOINT_STOP && AXIS_HOLD(entry) == current
+                                           ? current : AXIS_ENTER(entry);
+    const uint8_t level = direction != JOINT_STOP ? AXIS_LEVEL(entry) : 0;
+    const bool level_changed = level != pad->axis_level[number];
+    pad->axis_level[number] = level;
+
+    // Only a change of zone is a command. With proportional control a move
+    // within the zone retargets the joint's speed, which queues nothing
+    if (direction == current) {
+        if (level_changed && arm_controller_proportional(arm)) {
+            arm_send_speed(arm, axis->joint, direction, level);
+        }
+        return;
+    }
+    pad->axis_direction[number] = (uint8_t) direction;
+    pad->stats.commands++;
+    arm_send_speed(arm, axis->joint, direction, level);
+}
+
+//acts on one joystick event through the pad's input map
+void joystick_input_handle(struct joystick_input *pad, const struct js_event *js, struct arm_controller *arm) {
+    pad->stats.handled++;
+    TRACE_DEBUG(TRACE_JOYSTICK_EVENT, js->type, js->number, js->value);
+
+    // JS_EVENT_INIT snapshots are ignored
+    if (js->type == JS_EVENT_BUTTON && (js->value == 0 || js->value == 1)) {
+        joystick_button(pad, js->number, js->value == 1, arm);
+    } else if (js->type == JS_EVENT_AXIS) {
+        joystick_axis(pad, js->number, js->value, arm);
+    }
+}
+
+/*
+ * Everything the pad sent since the last wakeup, read in one go and collapsed
+ * so only the newest value of each axis and button gets acted on. A button
+ * that was pressed and released within the batch still gets both, so quick
+ * taps (lights on/off) aren't lost.
+ */
+#define JOYSTICK_READ_BATCH 64
+#define JOYSTICK_MAX_INPUTS 32
+
+struct joystick_batch {
+    __s16 axis_value[JOYSTICK_MAX_INPUTS];
+    __s16 button_value[JOYSTICK_MAX_INPUTS];
+    uint32_t axis_seen;       // bit per axis that moved in this batch
+    uint32_t button_seen;     // bit per button that changed in this batch
+    uint32_t button_tapped;   // bit per button that went down at some point in this batch
+};
+
+static void joystick_batch_add(struct joystick_input *pad, struct joystick_batch *batch,
+                               const struct js_event *js, struct arm_controller *arm) {
+    // Inputs beyond what we track are rare, just act on them straight away
+    if (js->number >= JOYSTICK_MAX_INPUTS) {
+        joystick_input_handle(pad, js, arm);
+        return;
+    }
+    const uint32_t bit = 1u << js->number;
+    if (js->type == JS_EVENT_AXIS) {
+        batch->axis_value[js->number] = js->value;
+        batch->axis_seen |= bit;
+    } else if (js->type == JS_EVENT_BUTTON) {
+        batch->button_value[js->number] = js->value;
+        batch->button_seen |= bit;
+        if (js->value == 1) {
+            batch->button_tapped |= bit;
+        }
+    }
+    // JS_EVENT_INIT snapshots are ignored, same as before batching
+}
+
+static void joystick_batch_dispatch(struct joystick_input *pad, const struct joystick_batch *batch,
+                                    struct arm_controller *arm) {
+    struct js_event js = { 0 };
+
+    js.type = JS_EVENT_BUTTON;
+    for (int i = 0; i < JOYSTICK_MAX_INPUTS; i++) {
+        if (!(batch->button_seen & (1u << i))) continue;
+        js.number = i;
+        if ((batch->button_tapped & (1u << i)) && batch->button_value[i] == 0) {
+            js.value = 1;
+            joystick_input_handle(pad, &js, arm);
+        }
+        js.value = batch->button_value[i];
+        joystick_input_handle(pad, &js, arm);
+    }
+
+    js.type = JS_EVENT_AXIS;
+    for (int i = 0; i < JOYSTICK_MAX_INPUTS; i++) {
+        if (!(batch->axis_seen & (1u << i))) continue;
+        js.number = i;
+        js.value = batch->axis_value[i];
+        joystick_input_handle(pad, &js, arm);
+    }
+}
+
+bool joystick_input_drain(struct joystick_input *pad, int fd, struct arm_controller *arm) {
+    struct js_event events[JOYSTICK_READ_BATCH];
+    struct joystick_batch batch;
+    batch.axis_seen = 0;
+    batch.button_seen = 0;
+    batch.button_tapped = 0;
+
+    // poll() just woke us for this input, so this is when it was picked up
+    latency_mark_input();
+
+    for (;;) {
+        const ssize_t bytes_read = read(fd, events, sizeof(events));
+        if (bytes_read == -1 && errno == EINTR) continue;
+        if (bytes_read == -1 && errno == EAGAIN) break;
+        if (bytes_read <= 0 || bytes_read % sizeof(struct js_event) != 0) {
+            latency_clear_input();
+            return false;
+        }
+
+        const size_t count = bytes_read / sizeof(struct js_event);
+        pad->stats.events += count;
+        metrics_add(METRIC_JOYSTICK_EVENTS, count);
+        if (pad->capture != NULL && fwrite(events, sizeof(events[0]), count, pad->capture) != count) {
+            perror("Error writing joystick capture, capture stopped");
+            pad->capture = NULL;
+        }
+        for (size_t i = 0; i < count; i++) {
+            joystick_batch_add(pad, &batch, &events[i], arm);
+        }
+        // A short read means the kernel buffer is empty
+        if (count < JOYSTICK_READ_BATCH) break;
+    }
+
+    joystick_batch_dispatch(pad, &batch, arm);
+    latency_clear_input();
+    return true;
+}
@@ -0,0 +1,129 @@
+#ifndef ARM_INPUT_H
+#define ARM_INPUT_H
+
+#include <linux/joystick.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arm_control.h"
+
+/*
+ * Input mapping shared by the front ends: which key, pad button or pad axis
+ * moves which joint. Every input is looked up in an input_map table indexed
+ * by its code, so dispatch is one array access whatever the mapping. The
+ * built-in map (input_map_default) can be replaced at startup with a file,
+ * see input_map_load and input-map.conf. Key codes are plain characters
+ * ('k', '1'...), which is also what GDK keyvals are for those keys. Escape,
+ * Tab, Return and BackSpace are their ASCII codes (27, 9, 13, 8); their GDK
+ * keyvals are those plus 0xff00, and the keyboard_input calls take either.
+ */
+#define INPUT_KEY_COUNT 256
+#define INPUT_BUTTON_COUNT 32
+#define INPUT_AXIS_COUNT 32
+
+enum input_release {
+    RELEASE_STOP,  // hold to move, the joint stops when the input is let go
+    RELEASE_NONE   // latch, the command stays (lights)
+};
+
+struct input_action {
+    bool mapped;
+    enum joint joint;
+    enum joint_direction direction;
+    enum input_release release;
+    bool estop;  // emergency stop, see arm_emergency_stop; the rest is unused
+};
+
+//the E-stop binding, Escape on the keyboard and button 8 on the pad by default
+#define INPUT_ACTION_ESTOP { .mapped = true, .release = RELEASE_NONE, .estop = true }
+
+/*
+ * How one pad axis is read. The stick is taken relative to center; within
+ * dead_zone of it the joint stops, at or beyond it the joint moves, and once
+ * moving it keeps going until the stick is back inside dead_zone - hysteresis,
+ * so a stick resting on the edge doesn't chatter. expo bends the output level
+ * from linear (0) towards cubic (100), for finer control near the dead zone.
+ */
+struct axis_calibration {
+    int center;
+    int dead_zone;
+    int hysteresis;
+    int expo;  // percent
+};
+
+#define AXIS_CALIBRATION_DEFAULT { .center = 0, .dead_zone = 10000, .hysteresis = 0, .expo = 0 }
+
+/*
+ * Calibration is compiled (input_map_compile) into a table with an entry for
+ * every raw axis value, indexed by the value as uint16_t, so handling an axis
+ * event is a single load whatever the settings. Each entry holds the output
+ * level 0-255 and the direction the value moves the joint in when it is
+ * stopped (enter) and when it is already moving that way (hold).
+ */
+#define AXIS_TABLE_SIZE 65536
+#define AXIS_LEVEL(entry) ((uint8_t) ((entry) & 0xFF))
+#define AXIS_ENTER(entry) ((enum joint_direction) (((entry) >> 8) & 3))
+#define AXIS_HOLD(entry) ((enum joint_direction) (((entry) >> 10) & 3))
+
+struct axis_action {
+    bool mapped;
+    enum joint joint;
+    enum joint_direction positive;  // direction above center, the opposite one below
+    struct axis_calibration calibration;
+    const uint16_t *table;          // compiled calibration, NULL until input_map_compile
+};
+
+struct input_map {
+    struct input_action keys[INPUT_KEY_COUNT];
+    struct input_action buttons[INPUT_BUTTON_COUNT];
+    struct axis_action axes[INPUT_AXIS_COUNT];
+    uint16_t *axis_tables;  // one block behind every axes[].table
+};
+
+//the bindings and calibration only; use input_map_load_default for a map the inputs can run on
+extern const struct input_map input_map_default;
+
+int input_map_load(struct input_map *map, const char *path);
+int input_map_load_default(struct input_map *map);
+int input_map_compile(struct input_map *map);
+void input_map_free(struct input_map *map);
+
+//keys currently held, to prevent repeated calling while a key auto-repeats
+struct keyboard_input {
+    const struct input_map *map;  // compiled, see input_map_load
+    uint64_t pressed[INPUT_KEY_COUNT / 64];
+};
+
+void keyboard_input_press(struct keyboard_input *keys, unsigned int key, struct arm_controller *arm);
+void keyboard_input_release(struct keyboard_input *keys, unsigned int key, struct arm_controller *arm);
+
+//whether key is bound to the emergency stop, for front ends that check it before anything else
+bool keyboard_input_emergency(const struct keyboard_input *keys, unsigned int key);
+
+struct joystick_input_stats {
+    unsigned long events;    // js_events read from the pad
+    unsigned long handled;   // events acted on once each read was collapsed
+    unsigned long commands;  // joint commands passed on; the rest fell in a dead zone or repeated a state
+};
+
+//where each pad control was last left, so only changes are sent
+struct joystick_input {
+    const struct input_map *map;  // compiled, see input_map_load
+    uint32_t buttons_pressed;
+    uint8_t axis_direction[INPUT_AXIS_COUNT];  // enum joint_direction each axis last asked for
+    uint8_t axis_level[INPUT_AXIS_COUNT];      // and how fast, 0-255 after calibration (see arm_send_speed)
+    FILE *capture;           // raw events are appended here as they are read (see arm_joyfeed.h), NULL for none
+    struct joystick_input_stats stats;
+};
+
+//acts on one joystick event
+void joystick_input_handle(struct joystick_input *pad, const struct js_event *js, struct arm_controller *arm);
+
+/**
+ * Reads every pending event from the (non-blocking) joystick fd and acts on the collapsed result.
+ * @return false if the pad has gone away.
+ */
+bool joystick_input_drain(struct joystick_input *pad, int fd, struct arm_controller *arm);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Joystick path benchmark. Plays a capture (or the synthetic generator) from
+ * arm_joyfeed.h through the same drain and mapping code as the pad listeners
+ * and reports how many events survived batching, dead zones and state dedup,
+ * and how many commands came out the other end.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arm_control.h"
+#include "arm_input.h"
+#include "arm_joyfeed.h"
+#include "arm_time.h"
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void on_quit_signal(int sig) {
+    quit_requested = 1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s " ARM_OPTIONS_USAGE " [--feed=CAPTURE | --feed=synth[:RATE[,COUNT[,SEED]]]]"
+                    " [--speed=FACTOR] [--input-map=FILE] [--verbose]\n"
+                    "--speed=0 feeds events as fast as they are taken.\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    struct arm_options options = ARM_OPTIONS_DEFAULT;
+    struct joystick_feed_config feed_config = JOYSTICK_FEED_CONFIG_DEFAULT;
+    static struct input_map input_map;
+    bool map_loaded = false;
+
+    for (int i = 1; i < argc; i++) {
+        const int parsed = arm_options_parse_arg(&options, argv[i]);
+        if (parsed < 0) {
+            return 1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "--feed=", strlen("--feed=")) == 0) {
+            if (joystick_feed_parse(argv[i] + strlen("--feed="), &feed_config) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--speed=", strlen("--speed=")) == 0) {
+            char *end;
+            feed_config.speed = strtod(argv[i] + strlen("--speed="), &end);
+            if (*end != '\0' || !(feed_config.speed >= 0)) {
+                fprintf(stderr, "--speed can't be negative\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--input-map=", strlen("--input-map=")) == 0) {
+            if (input_map_load(&input_map, argv[i] + strlen("--input-map=")) != 0) {
+                return 1;
+            }
+            map_loaded = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!map_loaded && input_map_load_default(&input_map) != 0) {
+        return 1;
+    }
+
+    struct sigaction quit_action = { .sa_handler = on_quit_signal };
+    sigemptyset(&quit_action.sa_mask);
+    sigaction(SIGINT, &quit_action, NULL);
+    sigaction(SIGTERM, &quit_action, NULL);
+
+    struct arm_controller *arm = arm_controller_open(&options);
+    if (arm == NULL) {
+        return 1;
+    }
+    arm_controller_bind_source(arm, SOURCE_JOYSTICK);
+
+    struct joystick_feed feed;
+    const int fd = joystick_feed_start(&feed, &feed_config);
+    if (fd < 0) {
+        arm_controller_close(arm, NULL);
+        return 1;
+    }
+
+    struct joystick_input pad = { .map = &input_map };
+    unsigned long wakeups = 0;
+    const long long start_ns = monotonic_ns();
+
+    // The listener loop of arm_cli, minus stdin
+    while (!quit_requested) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        arm_controller_heartbeat(arm);
+        if (poll(&pfd, 1, arm_controller_heartbeat_ms(arm)) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll failed");
+            break;
+        }
+        if (pfd.revents == 0) continue;  // heartbeat timeout
+        wakeups++;
+        if ((pfd.revents & (POLLERR | POLLNVAL)) || !joystick_input_drain(&pad, fd, arm)) {
+            break;  // end of the feed
+        }
+    }
+    const double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+
+    close(fd);
+    joystick_feed_stop(&feed);
+    arm_send_stop_all(arm);
+
+    const struct joystick_input_stats *stats = &pad.stats;
+    if (feed_config.path != NULL) {
+        printf("Feed: %s at %s\n", feed_config.path, feed_config.speed > 0 ? "recorded timing" : "full speed");
+    } else {
+        printf("Feed: synthetic, %u events/s, seed %u\n", feed_config.synth_rate, feed_config.synth_seed);
+    }
+    if (feed_config.speed > 0) {
+        printf("Speed %gx, %.3f s\n", feed_config.speed, elapsed_s);
+    } else {
+        printf("Unthrottled, %.3f s\n", elapsed_s);
+    }
+    printf("Events: %lu read (%.0f/s) in %lu wakeups, %lu acted on after batching, %lu commands sent (%.0f/s)\n",
+           stats->events, stats->events / elapsed_s, wakeups, stats->handled, stats->commands, stats->commands / elapsed_s);
+    if (stats->events > 0) {
+        printf("Collapsed by batching: %.1f%%, dropped by dead zones and dedup: %.1f%% of what was left\n",
+               100.0 * ((double) stats->events - (double) stats->handled) / (double) stats->events,
+               stats->handled > 0 ? 100.0 * (double) (stats->handled - stats->commands) / (double) stats->handled : 0.0);
+    }
+    arm_controller_close(arm, stdout);
+    input_map_free(&input_map);
+    return 0;
+}
@@ -0,0 +1,222 @@
+#include "arm_joyfeed.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arm_time.h"
+
+#define JOYFEED_BURST 64                // events per send, one read's worth for joystick_input_drain
+#define JOYFEED_SLEEP_CHUNK_NS 100000000LL  // long gaps are slept in pieces so stop isn't held up
+#define SYNTH_SWEEP_EVENTS 4000         // events per full stick sweep
+#define SYNTH_NOISE 1500                // +/- noise on every axis reading, chatter around the dead zones
+#define SYNTH_BUTTON_PERCENT 3          // share of events that are button presses or releases
+
+int joystick_feed_parse(const char *spec, struct joystick_feed_config *config) {
+    if (strncmp(spec, "synth", strlen("synth")) != 0) {
+        config->path = spec;
+        return spec[0] == '\0' ? -1 : 0;
+    }
+    config->path = NULL;
+    spec += strlen("synth");
+    if (*spec == '\0') {
+        return 0;
+    }
+    unsigned int rate;
+    unsigned long count = config->synth_count;
+    unsigned int seed = config->synth_seed;
+    if (*spec != ':' || sscanf(spec + 1, "%u,%lu,%u", &rate, &count, &seed) < 1 || rate == 0) {
+        return -1;
+    }
+    config->synth_rate = rate;
+    config->synth_count = count;
+    config->synth_seed = seed;
+    return 0;
+}
+
+static uint32_t synth_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * Event i of the synthetic stream: mostly the three mapped axes (1, 3, 5)
+ * sweeping end to end out of phase, with noise, and now and then a press or
+ * release of one of the six mapped buttons. Same seed, same stream.
+ */
+static struct js_event synth_event(unsigned long i, uint32_t *random, uint8_t *buttons,
+                                   const struct joystick_feed_config *config) {
+    static const uint8_t axes[] = { 1, 3, 5 };
+    struct js_event js = { .time = (uint32_t) (i * 1000 / config->synth_rate) };
+    const uint32_t r = synth_random(random);
+
+    if (r % 100 < SYNTH_BUTTON_PERCENT) {
+        const uint8_t button = (uint8_t) (r / 100 % 6);
+        *buttons ^= (uint8_t) (1u << button);
+        js.type = JS_EVENT_BUTTON;
+        js.number = button;
+        js.value = (*buttons >> button) & 1;
+        return js;
+    }
+
+    const unsigned int axis = r / 100 % 3;
+    const double phase = 2 * M_PI * ((double) i / SYNTH_SWEEP_EVENTS + axis / 3.0);
+    long value = lround(32767 * sin(phase)) + (long) (r >> 16) % (2 * SYNTH_NOISE + 1) - SYNTH_NOISE;
+    if (value > 32767) value = 32767;
+    if (value < -32767) value = -32767;
+    js.type = JS_EVENT_AXIS;
+    js.number = axes[axis];
+    js.value = (int16_t) value;
+    return js;
+}
+
+//when event i is due, in nanoseconds after the feed started, at speed 1
+static long long feed_offset_ns(const struct joystick_feed *feed, unsigned long i) {
+    if (feed->events != NULL) {
+        // Unsigned difference so a capture across the 32-bit millisecond wrap still plays
+        return (long long) (uint32_t) (feed->events[i].time - feed->events[0].time) * 1000000;
+    }
+    return (long long) i * 1000000000 / feed->config.synth_rate;
+}
+
+//sleeps until due, in pieces, false if the feed was stopped meanwhile
+static bool feed_sleep_until(struct joystick_feed *feed, long long due_ns) {
+    for (;;) {
+        if (!atomic_load(&feed->running)) return false;
+        const long long left = due_ns - monotonic_ns();
+        if (left <= 0) return true;
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        timespec_add_ns(&until, left < JOYFEED_SLEEP_CHUNK_NS ? left : JOYFEED_SLEEP_CHUNK_NS);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+    }
+}
+
+//sends one burst, waiting for the reader to make room; false once the feed is stopped or the reader has gone
+static bool feed_send(struct joystick_feed *feed, const struct js_event *burst, size_t n) {
+    for (;;) {
+        // SOCK_SEQPACKET keeps each burst whole, so the reader never sees part of an event
+        if (send(feed->write_fd, burst, n * sizeof(burst[0]), MSG_NOSIGNAL | MSG_DONTWAIT) != -1) {
+            return true;
+        }
+        if (errno != EAGAIN && errno != EINTR) {
+            if (errno != EPIPE && errno != ECONNRESET) perror("Error feeding joystick events");
+            return false;
+        }
+        struct pollfd pfd = { .fd = feed->write_fd, .events = POLLOUT };
+        poll(&pfd, 1, JOYFEED_SLEEP_CHUNK_NS / 1000000);
+        if (!atomic_load(&feed->running)) return false;
+    }
+}
+
+static void* joystick_feed_run(void *arg) {
+    struct joystick_feed *feed = arg;
+    const double speed = feed->config.speed;
+    const unsigned long total = feed->events != NULL ? feed->event_count : feed->config.synth_count;
+    uint32_t random = feed->config.synth_seed != 0 ? feed->config.synth_seed : 1;
+    uint8_t buttons = 0;
+    struct js_event burst[JOYFEED_BURST];
+    const long long start_ns = monotonic_ns();
+    unsigned long i = 0;
+
+    while (i < total) {
+        const long long due_ns = speed > 0 ? start_ns + (long long) (feed_offset_ns(feed, i) / speed) : 0;
+        if (speed > 0 && !feed_sleep_until(feed, due_ns)) break;
+
+        // Everything due by now goes in one send, like the kernel handing over several events at once
+        size_t n = 0;
+        const long long now_ns = monotonic_ns();
+        do {
+            burst[n++] = feed->events != NULL ? feed->events[i] : synth_event(i, &random, &buttons, &feed->config);
+            i++;
+        } while (n < JOYFEED_BURST && i < total
+                 && (speed == 0 || start_ns + (long long) (feed_offset_ns(feed, i) / speed) <= now_ns));
+
+        if (!feed_send(feed, burst, n)) break;
+        atomic_fetch_add_explicit(&feed->sent, n, memory_order_relaxed);
+    }
+
+    // The reader sees end of file, same as the pad being unplugged
+    shutdown(feed->write_fd, SHUT_WR);
+    return NULL;
+}
+
+static int joystick_feed_map(struct joystick_feed *feed, const char *path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error opening joystick capture");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % sizeof(struct js_event) != 0) {
+        fprintf(stderr, "%s is not a joystick capture\n", path);
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Error mapping joystick capture");
+        return -1;
+    }
+    feed->events = data;
+    feed->map_size = (size_t) st.st_size;
+    feed->event_count = feed->map_size / sizeof(struct js_event);
+    return 0;
+}
+
+int joystick_feed_start(struct joystick_feed *feed, const struct joystick_feed_config *config) {
+    memset(feed, 0, sizeof(*feed));
+    feed->config = *config;
+    feed->write_fd = -1;
+    if (config->path != NULL && joystick_feed_map(feed, config->path) != 0) {
+        return -1;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        perror("Error creating joystick feed");
+        joystick_feed_stop(feed);
+        return -1;
+    }
+    // Only the reading side is non-blocking, like the pad; the feed waits for room
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    feed->write_fd = fds[1];
+
+    feed->running = true;
+    if (pthread_create(&feed->thread, NULL, joystick_feed_run, feed) != 0) {
+        perror("Error starting joystick feed");
+        feed->running = false;
+        close(fds[0]);
+        joystick_feed_stop(feed);
+        return -1;
+    }
+    return fds[0];
+}
+
+void joystick_feed_stop(struct joystick_feed *feed) {
+    // The thread notices within JOYFEED_SLEEP_CHUNK_NS, whatever it is waiting on
+    if (atomic_exchange(&feed->running, false)) {
+        pthread_join(feed->thread, NULL);
+    }
+    if (feed->write_fd >= 0) {
+        close(feed->write_fd);
+        feed->write_fd = -1;
+    }
+    if (feed->events != NULL) {
+        munmap((void *) feed->events, feed->map_size);
+        feed->events = NULL;
+    }
+}
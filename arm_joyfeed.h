@@ -0,0 +1,59 @@
+#ifndef ARM_JOYFEED_H
+#define ARM_JOYFEED_H
+
+#include <linux/joystick.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Recorded or generated joystick input for testing without a pad. A capture
+ * file is just the raw struct js_event stream as read from /dev/input/jsN
+ * (`cat /dev/input/js0 > file` makes one too), so js_event.time carries the
+ * timing. A feed plays a capture, or the synthetic generator, into a pipe
+ * whose read end stands in for the pad's fd, so joystick_input_drain and the
+ * listener loops run exactly as they would on the device.
+ */
+#define JOYFEED_SYNTH_DEFAULT_RATE 1000     // events per second
+#define JOYFEED_SYNTH_DEFAULT_COUNT 20000
+
+struct joystick_feed_config {
+    const char *path;            // capture file to play, NULL for the synthetic generator
+    double speed;                // 1 = as recorded, 2 = twice as fast..., 0 = as fast as the reader takes them
+    unsigned int synth_rate;     // generator: events per second at speed 1
+    unsigned long synth_count;   // generator: events in total
+    unsigned int synth_seed;
+};
+
+#define JOYSTICK_FEED_CONFIG_DEFAULT { .speed = 1.0, .synth_rate = JOYFEED_SYNTH_DEFAULT_RATE, \
+                                       .synth_count = JOYFEED_SYNTH_DEFAULT_COUNT, .synth_seed = 1 }
+
+struct joystick_feed {
+    struct joystick_feed_config config;
+    const struct js_event *events;  // mapped capture, NULL when generating
+    size_t event_count;
+    size_t map_size;
+    int write_fd;
+    atomic_bool running;
+    atomic_ulong sent;
+    pthread_t thread;
+};
+
+/**
+ * "FILE" or "synth[:RATE[,COUNT[,SEED]]]" into config.
+ * @return 0, or -1 if it doesn't parse.
+ */
+int joystick_feed_parse(const char *spec, struct joystick_feed_config *config);
+
+/**
+ * Starts playing into a pipe.
+ * @return the non-blocking read end, which sees end of file once everything
+ * has been sent, or -1 (reported) on failure.
+ */
+int joystick_feed_start(struct joystick_feed *feed, const struct joystick_feed_config *config);
+
+//stops early if still playing and frees the feed; the caller closes the read end
+void joystick_feed_stop(struct joystick_feed *feed);
+
+#endif
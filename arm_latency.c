@@ -0,0 +1,103 @@
+#include "arm_latency.h"
+
+#include <stdatomic.h>
+
+#include "arm_time.h"
+
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * 26) // up to ~2^28 us
+
+struct latency_histogram {
+    atomic_ulong counts[LATENCY_BUCKETS];
+    atomic_ulong total;
+    atomic_llong max_us;
+};
+
+static const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {
+    [LATENCY_INPUT_TO_ENQUEUE] = "input -> queued",
+    [LATENCY_ENQUEUE_TO_WRITE] = "queued -> written",
+    [LATENCY_WRITE_TO_ACK] = "written -> status ack",
+    [LATENCY_INPUT_TO_WRITE] = "input -> written",
+    [LATENCY_STOP_TO_WRITE] = "stop -> written",
+};
+
+static struct latency_histogram latency_histograms[LATENCY_STAGE_COUNT];
+
+static unsigned int latency_bucket(long long us) {
+    if (us < LATENCY_SUB_BUCKETS) {
+        return us < 0 ? 0 : (unsigned int) us;
+    }
+    const int msb = 63 - __builtin_clzll((unsigned long long) us);
+    const int shift = msb - LATENCY_SUB_BITS;
+    const unsigned int bucket = LATENCY_SUB_BUCKETS + shift * LATENCY_SUB_BUCKETS
+                                + (unsigned int) ((us >> shift) - LATENCY_SUB_BUCKETS);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+//largest value (in us) that lands in a bucket
+static long long latency_bucket_upper(unsigned int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    const unsigned int shift = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+    const long long mantissa = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void latency_record(enum latency_stage stage, long long ns) {
+    struct latency_histogram *h = &latency_histograms[stage];
+    const long long us = ns / 1000;
+    atomic_fetch_add_explicit(&h->counts[latency_bucket(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    long long max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (us > max && !atomic_compare_exchange_weak_explicit(&h->max_us, &max, us,
+                                                              memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static long long latency_percentile(const struct latency_histogram *h, unsigned long total, double fraction) {
+    const unsigned long target = (unsigned long) (fraction * total + 0.999999);
+    const long long max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    unsigned long seen = 0;
+    for (unsigned int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen >= target) {
+            // A bucket's upper bound can overshoot the largest value actually seen
+            const long long upper = latency_bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+void latency_dump(FILE *out) {
+    fprintf(out, "Command latency (us):\n");
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        const struct latency_histogram *h = &latency_histograms[i];
+        const unsigned long total = atomic_load(&h->total);
+        if (total == 0) {
+            fprintf(out, "  %-22s no samples\n", latency_stage_names[i]);
+            continue;
+        }
+        fprintf(out, "  %-22s n=%lu p50=%lld p90=%lld p99=%lld p99.9=%lld max=%lld\n", latency_stage_names[i], total,
+                latency_percentile(h, total, 0.50), latency_percentile(h, total, 0.90),
+                latency_percentile(h, total, 0.99), latency_percentile(h, total, 0.999),
+                (long long) atomic_load(&h->max_us));
+    }
+}
+
+//when the input event currently being handled on this thread arrived (0 = none)
+static _Thread_local long long input_received_ns;
+
+void latency_mark_input(void) {
+    input_received_ns = monotonic_ns();
+}
+
+void latency_clear_input(void) {
+    input_received_ns = 0;
+}
+
+long long latency_input_ns(void) {
+    return input_received_ns;
+}
@@ -0,0 +1,33 @@
+#ifndef ARM_LATENCY_H
+#define ARM_LATENCY_H
+
+#include <stdio.h>
+
+/*
+ * Input-to-actuation latency. Every command carries the time its input event
+ * was handled and the time it was queued; the writer adds when write()/ioctl
+ * returned and the poller when the next status read after that came back.
+ * Each stage goes into a log-linear histogram (8 sub-buckets per power of two
+ * of microseconds, so percentiles are within 12.5%) that can be dumped at any
+ * time. Counters are atomic so any thread can record.
+ */
+enum latency_stage {
+    LATENCY_INPUT_TO_ENQUEUE,
+    LATENCY_ENQUEUE_TO_WRITE,
+    LATENCY_WRITE_TO_ACK,
+    LATENCY_INPUT_TO_WRITE,
+    LATENCY_STOP_TO_WRITE,   // priority lane: stop asked for -> written
+    LATENCY_STAGE_COUNT
+};
+
+void latency_record(enum latency_stage stage, long long ns);
+void latency_dump(FILE *out);
+
+//call when an input event is picked up; commands queued until latency_clear_input are stamped with it
+void latency_mark_input(void);
+void latency_clear_input(void);
+
+//the mark on the calling thread, 0 if none
+long long latency_input_ns(void);
+
+#endif
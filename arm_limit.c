@@ -0,0 +1,63 @@
+#include "arm_limit.h"
+
+#include <stdlib.h>
+
+int rate_limit_parse_config(const char *spec, struct rate_limit_config *out) {
+    unsigned long values[3] = { 0, LIMIT_JOINT_DEFAULT_HZ, LIMIT_BURST_DEFAULT };
+    const char *p = spec;
+
+    for (int i = 0; i < 3; i++) {
+        char *end;
+        if (*p < '0' || *p > '9') return -1;
+        values[i] = strtoul(p, &end, 10);
+        p = end;
+        if (*p == '\0') break;
+        if (*p != ',' || i == 2) return -1;
+        p++;
+    }
+    if (values[0] < LIMIT_MIN_HZ || values[0] > LIMIT_MAX_HZ
+            || values[1] < LIMIT_MIN_HZ || values[1] > LIMIT_MAX_HZ
+            || values[2] < 1 || values[2] > 1000) {
+        return -1;
+    }
+
+    out->link_hz = (unsigned int) values[0];
+    out->joint_hz = (unsigned int) values[1];
+    out->burst = (unsigned int) values[2];
+    return 0;
+}
+
+void token_bucket_init(struct token_bucket *b, unsigned int rate_hz, unsigned int burst) {
+    b->interval_ns = rate_hz > 0 ? 1000000000LL / rate_hz : 0;
+    b->depth_ns = b->interval_ns * (burst > 0 ? burst : 1);
+    b->full_ns = 0;
+}
+
+//how far from full the bucket is at now_ns
+static long long token_bucket_used_ns(const struct token_bucket *b, long long now_ns) {
+    return b->full_ns > now_ns ? b->full_ns - now_ns : 0;
+}
+
+unsigned int token_bucket_available(const struct token_bucket *b, long long now_ns) {
+    if (b->interval_ns == 0) return ~0u;
+    return (unsigned int) ((b->depth_ns - token_bucket_used_ns(b, now_ns)) / b->interval_ns);
+}
+
+bool token_bucket_take(struct token_bucket *b, long long now_ns, unsigned int count) {
+    const long long used_ns = token_bucket_used_ns(b, now_ns) + count * b->interval_ns;
+    if (used_ns > b->depth_ns) return false;
+    b->full_ns = now_ns + used_ns;
+    return true;
+}
+
+void token_bucket_charge(struct token_bucket *b, long long now_ns, unsigned int count) {
+    long long used_ns = token_bucket_used_ns(b, now_ns) + count * b->interval_ns;
+    if (used_ns > b->depth_ns) {
+        used_ns = b->depth_ns;  // empty, but it doesn't go into debt
+    }
+    b->full_ns = now_ns + used_ns;
+}
+
+long long token_bucket_ready_ns(const struct token_bucket *b, unsigned int count) {
+    return b->full_ns + count * b->interval_ns - b->depth_ns;
+}
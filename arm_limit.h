@@ -0,0 +1,54 @@
+#ifndef ARM_LIMIT_H
+#define ARM_LIMIT_H
+
+#include <stdbool.h>
+
+/*
+ * Token buckets for the writer (--limit), to keep the arm's controller below
+ * the rate at which it starts falling behind. One bucket covers every call
+ * on the link, ioctl frames and text writes alike; one per joint caps how
+ * often that joint can change, so a key toggled fast or a stick jittering
+ * on its dead zone can't fill the link on its own.
+ *
+ * A bucket holds up to burst tokens and gains one every 1/rate_hz. It is
+ * kept as the time it will next be full rather than a token count, so
+ * refilling needs no timer and no floating point.
+ */
+#define LIMIT_MIN_HZ 1
+#define LIMIT_MAX_HZ 100000
+#define LIMIT_JOINT_DEFAULT_HZ 50  // an up/stop pair 25 times a second
+#define LIMIT_BURST_DEFAULT 4
+
+struct rate_limit_config {
+    unsigned int link_hz;   // device calls per second, 0 = no limit
+    unsigned int joint_hz;  // changes per second for each joint
+    unsigned int burst;     // calls or changes let through at once after a quiet spell
+};
+
+#define RATE_LIMIT_CONFIG_DEFAULT { .link_hz = 0, .joint_hz = LIMIT_JOINT_DEFAULT_HZ, .burst = LIMIT_BURST_DEFAULT }
+
+struct token_bucket {
+    long long interval_ns;  // one token per interval
+    long long depth_ns;     // burst * interval
+    long long full_ns;      // when the bucket will be full again
+};
+
+//"HZ[,JOINT_HZ[,BURST]]" as --limit takes it; -1 if it doesn't parse or is out of range
+int rate_limit_parse_config(const char *spec, struct rate_limit_config *out);
+
+//a full bucket; rate_hz 0 is a bucket that never runs out
+void token_bucket_init(struct token_bucket *b, unsigned int rate_hz, unsigned int burst);
+
+//how many tokens there are at now_ns
+unsigned int token_bucket_available(const struct token_bucket *b, long long now_ns);
+
+//takes count tokens if there are that many
+bool token_bucket_take(struct token_bucket *b, long long now_ns, unsigned int count);
+
+//takes up to count tokens, as many as there are, for calls that go out whatever the limit (stops)
+void token_bucket_charge(struct token_bucket *b, long long now_ns, unsigned int count);
+
+//when token_bucket_take(count) will next succeed, now_ns or earlier if it would already
+long long token_bucket_ready_ns(const struct token_bucket *b, unsigned int count);
+
+#endif
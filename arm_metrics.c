@@ -0,0 +1,290 @@
+#include "arm_metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_time.h"
+
+// Histogram bucket upper bounds in microseconds, +Inf after the last
+static const long long metric_bounds_us[] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000,
+};
+
+#define METRIC_BUCKETS (sizeof(metric_bounds_us) / sizeof(metric_bounds_us[0]) + 1)
+
+struct metric_shard_histogram {
+    atomic_ulong buckets[METRIC_BUCKETS];  // not cumulative, the exporter adds them up
+    atomic_ulong sum_ns;
+};
+
+//one thread's counts: only that thread writes it (bar the shared one), only the exporter reads it
+struct metrics_shard {
+    _Alignas(64) atomic_ulong counters[METRIC_COUNTER_COUNT];
+    struct metric_shard_histogram histograms[METRIC_HISTOGRAM_COUNT];
+};
+
+static struct metrics_shard metrics_shards[METRICS_MAX_THREADS];
+static struct metrics_shard metrics_shared;   // for threads past METRICS_MAX_THREADS
+static atomic_uint metrics_shard_count;       // claimed so far, may run past METRICS_MAX_THREADS
+
+static _Thread_local struct metrics_shard *metrics_self;
+
+//a labelled group of counters, exported as one family
+struct metric_family {
+    const char *name;
+    const char *help;
+    const char *label;                // NULL for a single unlabelled counter
+    const char *const *values;        // the label's value for each counter
+    enum metric_counter first;
+    unsigned int count;
+};
+
+static const char *const joint_label_values[JOINT_COUNT] = {
+    [JOINT_BASE] = "base",
+    [JOINT_SHOULDER] = "shoulder",
+    [JOINT_ELBOW] = "elbow",
+    [JOINT_WRIST] = "wrist",
+    [JOINT_CLAW] = "claw",
+    [JOINT_LED] = "led",
+};
+
+static const char *const call_label_values[] = { "open", "write", "read", "ioctl" };
+
+static const struct metric_family counter_families[] = {
+    { "arm_joint_commands", "Joint changes written to the arm", "joint", joint_label_values,
+      METRIC_JOINT_COMMANDS, JOINT_COUNT },
+    { "arm_device_errors", "Device calls that failed", "call", call_label_values,
+      METRIC_DEVICE_OPEN_ERRORS, 4 },
+    { "arm_device_reconnects", "Device handles reopened after one went bad", NULL, NULL,
+      METRIC_DEVICE_RECONNECTS, 1 },
+    { "arm_joystick_events", "Joystick events read", NULL, NULL, METRIC_JOYSTICK_EVENTS, 1 },
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} histogram_families[METRIC_HISTOGRAM_COUNT] = {
+    [METRIC_STATUS_READ] = { "arm_status_read_seconds", "Time to read the arm's status" },
+    [METRIC_DEVICE_CALL] = { "arm_device_call_seconds", "Time for one write or ioctl to the arm" },
+};
+
+static struct metrics_shard* metrics_shard_self(void) {
+    if (metrics_self == NULL) {
+        const unsigned int index = atomic_fetch_add(&metrics_shard_count, 1);
+        metrics_self = index < METRICS_MAX_THREADS ? &metrics_shards[index] : &metrics_shared;
+    }
+    return metrics_self;
+}
+
+//adds n to a shard's value: a plain store on the thread's own shard, an atomic add on the shared one
+static void metrics_bump(const struct metrics_shard *shard, atomic_ulong *value, unsigned long n) {
+    if (shard == &metrics_shared) {
+        atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+    } else {
+        atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + n, memory_order_relaxed);
+    }
+}
+
+void metrics_add(enum metric_counter counter, unsigned long n) {
+    struct metrics_shard *shard = metrics_shard_self();
+    metrics_bump(shard, &shard->counters[counter], n);
+}
+
+void metrics_observe(enum metric_histogram histogram, long long ns) {
+    struct metrics_shard *shard = metrics_shard_self();
+    struct metric_shard_histogram *h = &shard->histograms[histogram];
+    const long long us = ns / 1000;
+    unsigned int bucket = 0;
+    while (bucket < METRIC_BUCKETS - 1 && us > metric_bounds_us[bucket]) {
+        bucket++;
+    }
+    metrics_bump(shard, &h->buckets[bucket], 1);
+    metrics_bump(shard, &h->sum_ns, ns > 0 ? (unsigned long) ns : 0);
+}
+
+//how many of metrics_shards have been claimed
+static unsigned int metrics_shards_used(void) {
+    const unsigned int count = atomic_load(&metrics_shard_count);
+    return count < METRICS_MAX_THREADS ? count : METRICS_MAX_THREADS;
+}
+
+//the value at offset in struct metrics_shard, added up over every shard
+static unsigned long metrics_sum(size_t offset) {
+    const atomic_ulong *shared = (const atomic_ulong *) ((const char *) &metrics_shared + offset);
+    unsigned long total = atomic_load_explicit(shared, memory_order_relaxed);
+    const unsigned int used = metrics_shards_used();
+    for (unsigned int i = 0; i < used; i++) {
+        const atomic_ulong *value = (const atomic_ulong *) ((const char *) &metrics_shards[i] + offset);
+        total += atomic_load_explicit(value, memory_order_relaxed);
+    }
+    return total;
+}
+
+unsigned long metrics_counter_total(enum metric_counter counter) {
+    return metrics_sum(offsetof(struct metrics_shard, counters[counter]));
+}
+
+void metrics_write_counter(FILE *out, const char *name, const char *help, unsigned long value) {
+    fprintf(out, "# TYPE %s counter\n# HELP %s %s.\n%s_total %lu\n", name, name, help, name, value);
+}
+
+void metrics_write_gauge(FILE *out, const char *name, const char *help, double value) {
+    fprintf(out, "# TYPE %s gauge\n# HELP %s %s.\n%s %g\n", name, name, help, name, value);
+}
+
+void metrics_write(FILE *out) {
+    for (size_t f = 0; f < sizeof(counter_families) / sizeof(counter_families[0]); f++) {
+        const struct metric_family *family = &counter_families[f];
+        fprintf(out, "# TYPE %s counter\n# HELP %s %s.\n", family->name, family->name, family->help);
+        for (unsigned int i = 0; i < family->count; i++) {
+            const unsigned long value = metrics_counter_total(family->first + i);
+            if (family->label != NULL) {
+                fprintf(out, "%s_total{%s=\"%s\"} %lu\n", family->name, family->label, family->values[i], value);
+            } else {
+                fprintf(out, "%s_total %lu\n", family->name, value);
+            }
+        }
+    }
+
+    for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++) {
+        const char *name = histogram_families[h].name;
+        fprintf(out, "# TYPE %s histogram\n# UNIT %s seconds\n# HELP %s %s.\n", name, name, name,
+                histogram_families[h].help);
+        unsigned long cumulative = 0;
+        for (unsigned int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += metrics_sum(offsetof(struct metrics_shard, histograms[h].buckets[b]));
+            if (b < METRIC_BUCKETS - 1) {
+                fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name, metric_bounds_us[b] / 1e6, cumulative);
+            } else {
+                fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+            }
+        }
+        const unsigned long sum_ns = metrics_sum(offsetof(struct metrics_shard, histograms[h].sum_ns));
+        fprintf(out, "%s_sum %.9f\n%s_count %lu\n", name, sum_ns / 1e9, name, cumulative);
+    }
+}
+
+static struct {
+    char *path;
+    char *temp_path;
+    metrics_collect_fn collect;
+    void *data;
+    bool failed;                     // the last export failed, so the next failure isn't reported again
+    unsigned long joystick_events;   // at the last export, for the rate
+    long long exported_ns;
+    bool running;                    // changed under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} exporter = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+//rewrites the metrics file (exporter thread, or metrics_export_stop once it has gone)
+static void metrics_export(void) {
+    FILE *out = fopen(exporter.temp_path, "w");
+    if (out == NULL) {
+        if (!exporter.failed) perror("Error writing metrics");
+        exporter.failed = true;
+        return;
+    }
+
+    metrics_write(out);
+    // Per second since the last export, for dashboards that don't take a rate of the counter
+    const long long now_ns = monotonic_ns();
+    const unsigned long events = metrics_counter_total(METRIC_JOYSTICK_EVENTS);
+    const double elapsed_s = (now_ns - exporter.exported_ns) / 1e9;
+    metrics_write_gauge(out, "arm_joystick_events_per_second", "Joystick events read per second since the last export",
+                        elapsed_s > 0 ? (events - exporter.joystick_events) / elapsed_s : 0.0);
+    exporter.joystick_events = events;
+    exporter.exported_ns = now_ns;
+
+    if (exporter.collect != NULL) {
+        exporter.collect(out, exporter.data);
+    }
+    fprintf(out, "# EOF\n");
+
+    if (fclose(out) != 0 || rename(exporter.temp_path, exporter.path) != 0) {
+        if (!exporter.failed) perror("Error writing metrics");
+        exporter.failed = true;
+        return;
+    }
+    exporter.failed = false;
+}
+
+static void* metrics_exporter_thread(void *arg) {
+    pthread_mutex_lock(&exporter.lock);
+    while (exporter.running) {
+        struct timespec deadline;
+        deadline_after_us(&deadline, METRICS_EXPORT_MS * 1000L);
+        while (exporter.running) {
+            if (pthread_cond_timedwait(&exporter.wake, &exporter.lock, &deadline) == ETIMEDOUT) break;
+        }
+        if (!exporter.running) break;
+        pthread_mutex_unlock(&exporter.lock);
+        metrics_export();
+        pthread_mutex_lock(&exporter.lock);
+    }
+    pthread_mutex_unlock(&exporter.lock);
+    return NULL;
+}
+
+/**
+ * Starts rewriting path with the current metrics every METRICS_EXPORT_MS,
+ * with collect's families added to each export. One exporter per process.
+ * @return 0, or -1 (reported) if the thread can't be started.
+ */
+int metrics_export_start(const char *path, metrics_collect_fn collect, void *data) {
+    if (exporter.path != NULL) {
+        fprintf(stderr, "Only one metrics exporter per process\n");
+        return -1;
+    }
+    exporter.path = strdup(path);
+    exporter.temp_path = malloc(strlen(path) + sizeof(".tmp"));
+    if (exporter.path == NULL || exporter.temp_path == NULL) {
+        perror("Error starting metrics export");
+        free(exporter.path);
+        free(exporter.temp_path);
+        exporter.path = NULL;
+        return -1;
+    }
+    strcpy(exporter.temp_path, path);
+    strcat(exporter.temp_path, ".tmp");
+    exporter.collect = collect;
+    exporter.data = data;
+    exporter.exported_ns = monotonic_ns();
+
+    // The first export is right away, so a scraper finds the file as soon as we're up
+    metrics_export();
+
+    monotonic_cond_init(&exporter.wake);
+    exporter.running = true;
+    if (pthread_create(&exporter.thread, NULL, metrics_exporter_thread, NULL) != 0) {
+        perror("Failed to create metrics exporter thread");
+        exporter.running = false;
+        free(exporter.path);
+        free(exporter.temp_path);
+        exporter.path = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_export_stop(void) {
+    if (exporter.path == NULL) return;
+
+    pthread_mutex_lock(&exporter.lock);
+    exporter.running = false;
+    pthread_cond_signal(&exporter.wake);
+    pthread_mutex_unlock(&exporter.lock);
+    pthread_join(exporter.thread, NULL);
+
+    metrics_export();
+    free(exporter.path);
+    free(exporter.temp_path);
+    exporter.path = NULL;
+    exporter.temp_path = NULL;
+}
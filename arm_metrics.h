@@ -0,0 +1,62 @@
+#ifndef ARM_METRICS_H
+#define ARM_METRICS_H
+
+#include <stdio.h>
+
+#include "arm_protocol.h"
+
+/*
+ * Runtime metrics (--metrics=FILE): counters and latency histograms that are
+ * always kept, and an exporter thread that rewrites FILE as OpenMetrics text
+ * every METRICS_EXPORT_MS, for a scraper such as node_exporter's textfile
+ * collector. The file is written to FILE.tmp and renamed over FILE, so a
+ * reader never sees half of one.
+ *
+ * Each thread updates its own shard with a plain load and store, no locked
+ * instruction and no shared cache line; the exporter adds the shards up. The
+ * first METRICS_MAX_THREADS threads to record get a shard, any after that
+ * share one with atomic adds. Shards outlive their threads, so nothing a
+ * thread counted is lost when it exits.
+ */
+#define METRICS_MAX_THREADS 32
+#define METRICS_EXPORT_MS 1000
+
+enum metric_counter {
+    METRIC_JOINT_COMMANDS,  // changes written to the arm, one counter per joint from here
+    METRIC_DEVICE_OPEN_ERRORS = METRIC_JOINT_COMMANDS + JOINT_COUNT,
+    METRIC_DEVICE_WRITE_ERRORS,
+    METRIC_DEVICE_READ_ERRORS,
+    METRIC_DEVICE_IOCTL_ERRORS,
+    METRIC_DEVICE_RECONNECTS,  // handles reopened after one went bad
+    METRIC_JOYSTICK_EVENTS,
+    METRIC_COUNTER_COUNT
+};
+
+enum metric_histogram {
+    METRIC_STATUS_READ,   // one status read from the arm
+    METRIC_DEVICE_CALL,   // one write or ioctl to the arm
+    METRIC_HISTOGRAM_COUNT
+};
+
+void metrics_add(enum metric_counter counter, unsigned long n);
+void metrics_observe(enum metric_histogram histogram, long long ns);
+
+//the value of counter summed over every thread
+unsigned long metrics_counter_total(enum metric_counter counter);
+
+//every counter and histogram as OpenMetrics families, without the closing "# EOF"
+void metrics_write(FILE *out);
+
+//called on the exporter thread to add families of its own to each export
+typedef void (*metrics_collect_fn)(FILE *out, void *data);
+
+//one unlabelled family for a collect function, name without the _total
+void metrics_write_counter(FILE *out, const char *name, const char *help, unsigned long value);
+void metrics_write_gauge(FILE *out, const char *name, const char *help, double value);
+
+int metrics_export_start(const char *path, metrics_collect_fn collect, void *data);
+
+//writes one last export and stops the thread
+void metrics_export_stop(void);
+
+#endif
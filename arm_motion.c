@@ -0,0 +1,200 @@
+#include "arm_motion.h"
+
+#include <errno.h>
+
+#include "arm_time.h"
+
+static unsigned int motion_target_pack(enum joint_direction direction, unsigned int level) {
+    if (direction == JOINT_STOP || level == 0) return 0;
+    return (unsigned int) direction << 8 | (level > MOTION_LEVEL_MAX ? MOTION_LEVEL_MAX : level);
+}
+
+void motion_scheduler_set(struct motion_scheduler *s, enum joint joint, enum joint_direction direction,
+                          unsigned int level) {
+    const unsigned short target = (unsigned short) motion_target_pack(direction, level);
+    if (atomic_exchange(&s->target[joint], target) == target) return;
+
+    // Pairs with the scheduler setting sleeping before it re-checks the targets
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void motion_scheduler_halt(struct motion_scheduler *s) {
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        atomic_store(&s->target[joint], 0);
+    }
+    atomic_fetch_add(&s->halts, 1);
+}
+
+static void motion_send(struct motion_scheduler *s, enum joint joint, enum joint_direction direction) {
+    if (s->send(s->data, joint, direction) != 0) {
+        s->stats.refused++;
+        return;  // output stays as it was, so the change is tried again next tick
+    }
+    s->output[joint] = direction;
+    s->stats.pulses++;
+}
+
+//one joint's ramp and pulse for this tick
+static void motion_tick_joint(struct motion_scheduler *s, enum joint joint, unsigned int step) {
+    const unsigned int target = atomic_load_explicit(&s->target[joint], memory_order_relaxed);
+    const enum joint_direction target_direction = (enum joint_direction) (target >> 8);
+    const unsigned int target_level = target & 0xFF;
+
+    // A reversal ramps down to zero in the old direction before starting the new one
+    unsigned int level = s->level[joint];
+    if (level == 0) {
+        s->direction[joint] = target_direction;
+    }
+    const unsigned int goal = s->direction[joint] == target_direction ? target_level : 0;
+    if (level < goal) {
+        level = goal - level > step ? level + step : goal;
+    } else if (level > goal) {
+        level = level - goal > step ? level - step : goal;
+    }
+    s->level[joint] = level;
+
+    enum joint_direction want = JOINT_STOP;
+    if (level >= MOTION_LEVEL_MAX) {
+        want = s->direction[joint];
+    } else if (level > 0) {
+        s->error[joint] += level;
+        if (s->error[joint] >= MOTION_LEVEL_MAX) {
+            s->error[joint] -= MOTION_LEVEL_MAX;
+            want = s->direction[joint];
+        }
+    }
+    if (want != s->output[joint]) {
+        motion_send(s, joint, want);
+    }
+}
+
+//true once every joint is stopped and nothing is asked for
+static bool motion_idle(struct motion_scheduler *s) {
+    for (int joint = 0; joint < JOINT_LED; joint++) {
+        if (s->level[joint] != 0 || s->output[joint] != JOINT_STOP
+                || atomic_load_explicit(&s->target[joint], memory_order_relaxed) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//parks until a target is set or stop is requested, false if stopping
+static bool motion_wait(struct motion_scheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    atomic_store(&s->sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (s->running && motion_idle(s)) {
+        pthread_cond_wait(&s->wake, &s->lock);
+    }
+    atomic_store(&s->sleeping, false);
+    const bool running = s->running;
+    pthread_mutex_unlock(&s->lock);
+    return running;
+}
+
+static void* motion_scheduler_thread(void *arg) {
+    struct motion_scheduler *s = arg;
+    const long long period_ns = 1000000000LL / s->pulse_hz;
+    // Level change per tick, so a full ramp takes ramp_ms
+    unsigned int step = MOTION_LEVEL_MAX;
+    if (s->ramp_ms > 0) {
+        step = (unsigned int) (MOTION_LEVEL_MAX * 1000ULL / ((unsigned long long) s->pulse_hz * s->ramp_ms));
+        if (step == 0) step = 1;
+    }
+
+    if (s->bind != NULL) {
+        s->bind(s->data);
+    }
+
+    for (;;) {
+        if (motion_idle(s) && !motion_wait(s)) break;
+
+        // Ticks are counted from when motion started, absolute so they don't drift
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!motion_idle(s)) {
+            pthread_mutex_lock(&s->lock);
+            const bool running = s->running;
+            pthread_mutex_unlock(&s->lock);
+            if (!running) break;
+
+            // stop:all was sent behind our back: the joints are stopped, drop the ramps.
+            // Joints we still think are on get a stop, which joint state drops if stop:all covered it
+            const unsigned int halts = atomic_load(&s->halts);
+            if (halts != s->seen_halts) {
+                s->seen_halts = halts;
+                for (int joint = 0; joint < JOINT_LED; joint++) {
+                    s->level[joint] = 0;
+                    if (s->output[joint] != JOINT_STOP) {
+                        motion_send(s, joint, JOINT_STOP);
+                    }
+                }
+            }
+
+            for (int joint = 0; joint < JOINT_LED; joint++) {
+                motion_tick_joint(s, joint, step);
+            }
+            s->stats.ticks++;
+
+            timespec_add_ns(&next, period_ns);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            }
+        }
+
+        pthread_mutex_lock(&s->lock);
+        const bool running = s->running;
+        pthread_mutex_unlock(&s->lock);
+        if (!running) break;
+    }
+
+    // Leave nothing running
+    for (int joint = 0; joint < JOINT_LED; joint++) {
+        if (s->output[joint] != JOINT_STOP) {
+            motion_send(s, joint, JOINT_STOP);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Starts the scheduler thread, which sleeps until the first target is set.
+ * @return 0, or -1 if the thread can't be created.
+ */
+int motion_scheduler_start(struct motion_scheduler *s, unsigned int pulse_hz, unsigned int ramp_ms,
+                           motion_send_fn send, motion_bind_fn bind, void *data) {
+    pthread_mutex_init(&s->lock, NULL);
+    monotonic_cond_init(&s->wake);
+    s->pulse_hz = pulse_hz;
+    s->ramp_ms = ramp_ms;
+    s->send = send;
+    s->bind = bind;
+    s->data = data;
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        atomic_init(&s->target[joint], 0);
+        s->direction[joint] = JOINT_STOP;
+        s->level[joint] = 0;
+        s->output[joint] = JOINT_STOP;
+        // Out of phase, so equal levels pulse in different ticks
+        s->error[joint] = (unsigned int) joint * MOTION_LEVEL_MAX / JOINT_LED;
+    }
+    s->running = true;
+    if (pthread_create(&s->thread, NULL, motion_scheduler_thread, s) != 0) {
+        s->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void motion_scheduler_stop(struct motion_scheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    s->running = false;
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+}
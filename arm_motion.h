@@ -0,0 +1,79 @@
+#ifndef ARM_MOTION_H
+#define ARM_MOTION_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "arm_protocol.h"
+
+/*
+ * Motion scheduler: proportional speed for motors that only know on and off.
+ * Each joint is given a direction and a level (0-255) and the scheduler
+ * pulses it at that duty cycle on a fixed tick. Every tick it works out which
+ * joints are on and hands all of that tick's changes to send together, so
+ * the dispatcher folds them into one frame rather than one per joint.
+ *
+ * Levels ramp towards their target by a fixed step per tick (soft start and
+ * soft stop); a reversal ramps down through zero first. Pulses come from a
+ * per-joint error accumulator (first order sigma-delta), each joint started
+ * at a different phase so joints at the same level don't all switch in the
+ * same tick. Level 255 is plain on, no pulses. The LED is not scheduled.
+ */
+#define MOTION_PULSE_DEFAULT_HZ 50
+#define MOTION_PULSE_MIN_HZ 10
+#define MOTION_PULSE_MAX_HZ 200
+#define MOTION_RAMP_DEFAULT_MS 150  // stopped to full speed, and back
+#define MOTION_LEVEL_MAX 255
+
+//hands one joint change to the dispatcher, called on the scheduler thread
+typedef int (*motion_send_fn)(void *data, enum joint joint, enum joint_direction direction);
+//called once on the scheduler thread before its first tick
+typedef void (*motion_bind_fn)(void *data);
+
+struct motion_stats {
+    unsigned long ticks;
+    unsigned long pulses;   // joint changes sent
+    unsigned long refused;  // changes send couldn't queue, retried next tick
+};
+
+struct motion_scheduler {
+    unsigned int pulse_hz;
+    unsigned int ramp_ms;
+    motion_send_fn send;
+    motion_bind_fn bind;  // may be NULL
+    void *data;
+    atomic_ushort target[JOINT_COUNT];  // direction << 8 | level, set from any thread
+    atomic_uint halts;                  // bumped by motion_scheduler_halt
+    atomic_bool sleeping;               // parked on wake until a target is set
+    bool running;                       // changed under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    // Scheduler thread only
+    enum joint_direction direction[JOINT_COUNT];  // direction being ramped and pulsed
+    unsigned int level[JOINT_COUNT];              // ramped level
+    unsigned int error[JOINT_COUNT];              // sigma-delta accumulator
+    enum joint_direction output[JOINT_COUNT];     // what the joint was last sent
+    unsigned int seen_halts;
+    struct motion_stats stats;                    // read once the thread has been joined
+};
+
+int motion_scheduler_start(struct motion_scheduler *s, unsigned int pulse_hz, unsigned int ramp_ms,
+                           motion_send_fn send, motion_bind_fn bind, void *data);
+
+//sends a stop for every joint it left moving and waits for the thread
+void motion_scheduler_stop(struct motion_scheduler *s);
+
+//sets where a joint is heading; level 0 or JOINT_STOP ramps it to a stop
+void motion_scheduler_set(struct motion_scheduler *s, enum joint joint, enum joint_direction direction,
+                          unsigned int level);
+
+/*
+ * Drops every target and level to zero at once, without ramping, for when
+ * the caller has stopped the arm itself (stop:all). A pulse the scheduler
+ * was sending at that moment is stopped again on its next tick.
+ */
+void motion_scheduler_halt(struct motion_scheduler *s);
+
+#endif
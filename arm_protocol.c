@@ -0,0 +1,147 @@
+#include "arm_protocol.h"
+
+#include <string.h>
+
+//returns the text just after prefix, or NULL if s doesn't start with it
+static const char* match_prefix(const char *s, const char *prefix) {
+    while (*prefix != '\0') {
+        if (*s++ != *prefix++) return NULL;
+    }
+    return s;
+}
+
+//length of the field value, which runs up to the next whitespace
+static size_t field_length(const char *s) {
+    size_t len = 0;
+    while (s[len] != '\0' && s[len] != ' ' && s[len] != '\t' && s[len] != '\n' && s[len] != '\r') {
+        len++;
+    }
+    return len;
+}
+
+static bool field_equals(const char *field, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(field, word, len) == 0;
+}
+
+static const char* skip_spaces(const char *s) {
+    while (*s == ' ' || *s == '\t') s++;
+    return s;
+}
+
+/**
+ * Parses a status line from the device without allocating.
+ * @param line: NUL-terminated line read from the device.
+ * @param out: only written if the whole line parsed.
+ * @return 0 on success, -1 if the line isn't in the expected format.
+ */
+int parse_robot_status(const char *line, struct robot_status *out) {
+    struct robot_status parsed;
+    size_t len;
+
+    const char *p = match_prefix(line, "connected:");
+    if (p == NULL) return -1;
+    len = field_length(p);
+    parsed.connected = field_equals(p, len, "yes");
+
+    p = match_prefix(skip_spaces(p + len), "status:");
+    if (p == NULL) return -1;
+    len = field_length(p);
+    if (field_equals(p, len, "good")) {
+        parsed.command = COMMAND_STATE_GOOD;
+    } else if (field_equals(p, len, "bad")) {
+        parsed.command = COMMAND_STATE_BAD;
+    } else {
+        parsed.command = COMMAND_STATE_NONE;
+    }
+
+    p = match_prefix(skip_spaces(p + len), "battery:");
+    if (p == NULL || *p < '0' || *p > '9') return -1;
+    parsed.battery = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        parsed.battery = parsed.battery * 10 + (*p - '0');
+        if (parsed.battery > BATTERY_MAX) {
+            parsed.battery = -1;
+            break;
+        }
+    }
+
+    *out = parsed;
+    return 0;
+}
+
+bool robot_status_equal(const struct robot_status *a, const struct robot_status *b) {
+    return a->connected == b->connected && a->command == b->command && a->battery == b->battery;
+}
+
+const struct joint_encoding joint_encodings[JOINT_COUNT] = {
+    [JOINT_BASE]     = { 1, 0x03, { 0x00, 0x01, 0x02 }, { "base:stop", "base:right", "base:left" } },
+    [JOINT_SHOULDER] = { 0, 0xC0, { 0x00, 0x40, 0x80 }, { "shoulder:stop", "shoulder:up", "shoulder:down" } },
+    [JOINT_ELBOW]    = { 0, 0x30, { 0x00, 0x10, 0x20 }, { "elbow:stop", "elbow:up", "elbow:down" } },
+    [JOINT_WRIST]    = { 0, 0x0C, { 0x00, 0x04, 0x08 }, { "wrist:stop", "wrist:up", "wrist:down" } },
+    [JOINT_CLAW]     = { 0, 0x03, { 0x00, 0x02, 0x01 }, { "claw:stop", "claw:open", "claw:close" } },
+    [JOINT_LED]      = { 2, 0x01, { 0x00, 0x01, 0x00 }, { "led:off", "led:on", "led:off" } },
+};
+
+static int* frame_byte(struct device_command *frame, unsigned char byte) {
+    return byte == 0 ? &frame->var1 : byte == 1 ? &frame->var2 : &frame->var3;
+}
+
+/**
+ * Updates one joint in a frame, leaving every other motor as it was.
+ * @param frame: the full arm state, becomes the frame to send.
+ */
+void encode_joint(struct device_command *frame, enum joint joint, enum joint_direction direction) {
+    const struct joint_encoding *enc = &joint_encodings[joint];
+    int *byte = frame_byte(frame, enc->byte);
+    *byte = (*byte & ~enc->mask) | enc->bits[direction];
+}
+
+//stops every motor, the LED keeps its state
+void encode_stop_all(struct device_command *frame) {
+    frame->var1 = 0;
+    frame->var2 = 0;
+}
+
+//reads back which way a joint is set in a frame
+enum joint_direction decode_joint(const struct device_command *frame, enum joint joint) {
+    const struct joint_encoding *enc = &joint_encodings[joint];
+    const int bits = *frame_byte((struct device_command *) frame, enc->byte) & enc->mask;
+    if (bits != 0 && bits == enc->bits[JOINT_POS]) return JOINT_POS;
+    if (bits != 0 && bits == enc->bits[JOINT_NEG]) return JOINT_NEG;
+    return JOINT_STOP;
+}
+
+bool frame_is_moving(const struct device_command *frame) {
+    return frame->var1 != 0 || frame->var2 != 0;
+}
+
+//a frame the driver would accept: every joint stopped or going one way, no other bits set
+bool frame_is_valid(const struct device_command *frame) {
+    struct device_command rebuilt = { .var1 = 0, .var2 = 0, .var3 = 0 };
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        encode_joint(&rebuilt, joint, decode_joint(frame, joint));
+    }
+    return memcmp(&rebuilt, frame, sizeof(rebuilt)) == 0;
+}
+
+/**
+ * Looks a text command ("elbow:up", "led:off"...) up in joint_encodings.
+ * stop:all is not a single joint and is left to the caller.
+ * @param len: length of text, which need not be NUL-terminated.
+ * @return 0 if it names a joint and direction, -1 otherwise.
+ */
+int parse_joint_command(const char *text, size_t len, enum joint *joint, enum joint_direction *direction) {
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')) {
+        len--;
+    }
+    for (int j = 0; j < JOINT_COUNT; j++) {
+        for (int d = JOINT_STOP; d <= JOINT_NEG; d++) {
+            if (field_equals(text, len, joint_encodings[j].text[d])) {
+                *joint = j;
+                *direction = d;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
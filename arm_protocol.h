@@ -0,0 +1,76 @@
+#ifndef ARM_PROTOCOL_H
+#define ARM_PROTOCOL_H
+
+#include <stdbool.h>
+
+#include "arm_device.h"
+
+/*
+ * Status line from the driver, e.g. "connected:yes status:good battery:3".
+ * Parsed in place into a fixed struct, nothing is allocated.
+ */
+enum command_state {
+    COMMAND_STATE_NONE,
+    COMMAND_STATE_GOOD,
+    COMMAND_STATE_BAD
+};
+
+#define BATTERY_MAX 4
+
+struct robot_status {
+    bool connected;
+    enum command_state command;
+    int battery;  // 0..BATTERY_MAX, -1 if the driver reported something out of range
+};
+
+int parse_robot_status(const char *line, struct robot_status *out);
+bool robot_status_equal(const struct robot_status *a, const struct robot_status *b);
+
+/*
+ * Binary motion encoding. The A37JN takes a three-byte frame (var1..var3 of
+ * device_command) holding the state of every motor at once:
+ *   var1: claw 0x01 close / 0x02 open, wrist 0x04 up / 0x08 down,
+ *         elbow 0x10 up / 0x20 down, shoulder 0x40 up / 0x80 down
+ *   var2: base 0x01 right / 0x02 left
+ *   var3: led 0x01 on
+ * The LED is handled as one more "joint" so every output goes through the same table.
+ */
+enum joint {
+    JOINT_BASE,
+    JOINT_SHOULDER,
+    JOINT_ELBOW,
+    JOINT_WRIST,
+    JOINT_CLAW,
+    JOINT_LED,
+    JOINT_COUNT
+};
+
+enum joint_direction {
+    JOINT_STOP,
+    JOINT_POS,  // right / up / open / led on
+    JOINT_NEG   // left / down / close / led off
+};
+
+struct joint_encoding {
+    unsigned char byte;         // 0 = var1, 1 = var2, 2 = var3
+    unsigned char mask;         // every bit this joint owns in that byte
+    unsigned char bits[3];      // indexed by joint_direction
+    const char *text[3];        // same command for the text transport
+};
+
+extern const struct joint_encoding joint_encodings[JOINT_COUNT];
+
+//which transport joint commands go out on, picked once at startup
+enum command_transport {
+    TRANSPORT_TEXT,  // "joint:direction" strings through write()
+    TRANSPORT_IOCTL  // encoded frames through IOCTL_SET_VALUE
+};
+
+void encode_joint(struct device_command *frame, enum joint joint, enum joint_direction direction);
+void encode_stop_all(struct device_command *frame);
+enum joint_direction decode_joint(const struct device_command *frame, enum joint joint);
+bool frame_is_moving(const struct device_command *frame);
+bool frame_is_valid(const struct device_command *frame);
+int parse_joint_command(const char *text, size_t len, enum joint *joint, enum joint_direction *direction);
+
+#endif
@@ -0,0 +1,162 @@
+#include "arm_record.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COMMAND_LOG_FRAME_LEN (3 * sizeof(int32_t))
+
+/**
+ * Starts a new log at path, replacing whatever was there. One log per session,
+ * so its timestamps all come from the same boot.
+ * @return 0, or -1 (reported) if it can't be created.
+ */
+int command_recorder_open(struct command_recorder *rec, const char *path) {
+    memset(rec, 0, sizeof(*rec));
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        perror("Error creating command log");
+        return -1;
+    }
+
+    uint8_t header[COMMAND_LOG_HEADER_LEN] = { 0 };
+    const uint32_t version = COMMAND_LOG_VERSION;
+    memcpy(header, COMMAND_LOG_MAGIC, strlen(COMMAND_LOG_MAGIC));
+    memcpy(header + 8, &version, sizeof(version));
+    if (fwrite(header, sizeof(header), 1, rec->file) != 1) {
+        perror("Error writing command log");
+        fclose(rec->file);
+        rec->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+//stdio buffers the entry, so recording costs the writer thread a memcpy and not a syscall
+static void command_recorder_append(struct command_recorder *rec, long long time_ns, enum command_log_kind kind,
+                                    const void *payload, size_t len) {
+    if (rec->file == NULL || rec->failed) return;
+
+    uint8_t entry[COMMAND_LOG_ENTRY_LEN + COMMAND_MAX_LEN];
+    const int64_t stamp = time_ns;
+    memcpy(entry, &stamp, sizeof(stamp));
+    entry[8] = (uint8_t) kind;
+    entry[9] = (uint8_t) len;
+    memcpy(entry + COMMAND_LOG_ENTRY_LEN, payload, len);
+
+    if (fwrite(entry, COMMAND_LOG_ENTRY_LEN + len, 1, rec->file) != 1) {
+        perror("Error writing command log, recording stopped");
+        rec->failed = true;
+        return;
+    }
+    rec->entries++;
+}
+
+void command_recorder_text(struct command_recorder *rec, long long time_ns, const char *text, size_t len) {
+    if (len >= COMMAND_MAX_LEN) {
+        len = COMMAND_MAX_LEN - 1;
+    }
+    command_recorder_append(rec, time_ns, COMMAND_LOG_TEXT, text, len);
+}
+
+void command_recorder_frame(struct command_recorder *rec, long long time_ns, const struct device_command *frame) {
+    const int32_t vars[3] = { frame->var1, frame->var2, frame->var3 };
+    command_recorder_append(rec, time_ns, COMMAND_LOG_FRAME, vars, sizeof(vars));
+}
+
+void command_recorder_close(struct command_recorder *rec) {
+    if (rec->file == NULL) return;
+    if (fclose(rec->file) != 0) {
+        perror("Error closing command log");
+    }
+    rec->file = NULL;
+}
+
+/**
+ * Maps a log read-only. Pages are faulted in as replay reaches them, so a
+ * long log never has to fit in memory at once.
+ * @return 0, or -1 (reported) if it can't be read or isn't a command log.
+ */
+int command_log_open(struct command_log *log, const char *path) {
+    memset(log, 0, sizeof(*log));
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error opening command log");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading command log");
+        close(fd);
+        return -1;
+    }
+
+    uint32_t version = 0;
+    if (st.st_size >= COMMAND_LOG_HEADER_LEN) {
+        log->data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (log->data == MAP_FAILED) {
+            perror("Error mapping command log");
+            log->data = NULL;
+            close(fd);
+            return -1;
+        }
+        log->size = (size_t) st.st_size;
+        memcpy(&version, log->data + 8, sizeof(version));
+    }
+    close(fd);
+
+    if (log->data == NULL || memcmp(log->data, COMMAND_LOG_MAGIC, strlen(COMMAND_LOG_MAGIC)) != 0
+            || version != COMMAND_LOG_VERSION) {
+        fprintf(stderr, "%s is not a command log this version can read\n", path);
+        command_log_close(log);
+        return -1;
+    }
+    // Replay reads straight through
+    madvise((void *) log->data, log->size, MADV_SEQUENTIAL);
+    log->pos = COMMAND_LOG_HEADER_LEN;
+    return 0;
+}
+
+bool command_log_next(struct command_log *log, struct command_log_entry *entry) {
+    if (log->size - log->pos < COMMAND_LOG_ENTRY_LEN) {
+        return false;
+    }
+    const uint8_t *p = log->data + log->pos;
+    const size_t len = p[9];
+    if (log->size - log->pos - COMMAND_LOG_ENTRY_LEN < len) {
+        return false;
+    }
+
+    int64_t stamp;
+    memcpy(&stamp, p, sizeof(stamp));
+    entry->time_ns = stamp;
+    entry->kind = p[8];
+    const uint8_t *payload = p + COMMAND_LOG_ENTRY_LEN;
+
+    if (entry->kind == COMMAND_LOG_FRAME && len == COMMAND_LOG_FRAME_LEN) {
+        int32_t vars[3];
+        memcpy(vars, payload, sizeof(vars));
+        entry->frame = (struct device_command) { .var1 = vars[0], .var2 = vars[1], .var3 = vars[2] };
+    } else if (entry->kind == COMMAND_LOG_TEXT && len < COMMAND_MAX_LEN) {
+        memcpy(entry->text, payload, len);
+        entry->text[len] = '\0';
+    } else {
+        // Not something this version wrote: treat it as the end rather than guess
+        return false;
+    }
+    log->pos += COMMAND_LOG_ENTRY_LEN + len;
+    return true;
+}
+
+void command_log_rewind(struct command_log *log) {
+    log->pos = COMMAND_LOG_HEADER_LEN;
+}
+
+void command_log_close(struct command_log *log) {
+    if (log->data != NULL) {
+        munmap((void *) log->data, log->size);
+    }
+    memset(log, 0, sizeof(*log));
+}
@@ -0,0 +1,68 @@
+#ifndef ARM_RECORD_H
+#define ARM_RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arm_device.h"
+#include "arm_dispatcher.h"
+
+/*
+ * Command log: every text write and ioctl frame the writer thread delivers
+ * to the arm, stamped with monotonic nanoseconds, so a demonstrated motion
+ * can be played back later with the same timing.
+ *
+ * The file is a 16-byte header (COMMAND_LOG_MAGIC, version, 0) followed by
+ * packed entries, only ever appended to:
+ *   int64 time_ns, uint8 kind, uint8 len, len bytes of payload
+ * where the payload is the command text, or var1..var3 as three int32 for a
+ * frame. Host byte order; a log is replayed on the machine that made it. An
+ * entry cut short by a crash ends the log instead of corrupting it.
+ */
+#define COMMAND_LOG_MAGIC "A37JNLOG"
+#define COMMAND_LOG_VERSION 1
+#define COMMAND_LOG_HEADER_LEN 16
+#define COMMAND_LOG_ENTRY_LEN 10 // before the payload
+
+enum command_log_kind {
+    COMMAND_LOG_TEXT = 1,
+    COMMAND_LOG_FRAME = 2
+};
+
+//appends to a log; only the writer thread touches it, so it has no lock
+struct command_recorder {
+    FILE *file;
+    unsigned long entries;
+    bool failed;  // a write failed, the rest of the session isn't recorded
+};
+
+int command_recorder_open(struct command_recorder *rec, const char *path);
+void command_recorder_text(struct command_recorder *rec, long long time_ns, const char *text, size_t len);
+void command_recorder_frame(struct command_recorder *rec, long long time_ns, const struct device_command *frame);
+void command_recorder_close(struct command_recorder *rec);
+
+//a log mapped into memory and read in place, however long it is
+struct command_log {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+struct command_log_entry {
+    long long time_ns;
+    enum command_log_kind kind;
+    struct device_command frame;  // COMMAND_LOG_FRAME
+    char text[COMMAND_MAX_LEN];   // COMMAND_LOG_TEXT, nul terminated
+};
+
+int command_log_open(struct command_log *log, const char *path);
+
+//next entry, false at the end of the log
+bool command_log_next(struct command_log *log, struct command_log_entry *entry);
+
+void command_log_rewind(struct command_log *log);
+void command_log_close(struct command_log *log);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Plays back a command log recorded with --record, so a motion demonstrated
+ * once from the GUI, the CLI or the daemon can be repeated with the same
+ * timing. Goes through the normal controller, so --mock and --connect work
+ * here too.
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_control.h"
+#include "arm_latency.h"
+#include "arm_record.h"
+#include "arm_time.h"
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void on_quit_signal(int sig) {
+    quit_requested = 1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s " ARM_OPTIONS_USAGE " [--speed=FACTOR] [--loop=COUNT] [--verbose] LOG\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    struct arm_options options = ARM_OPTIONS_DEFAULT;
+    const char *log_path = NULL;
+    double speed = 1.0;
+    unsigned long loops = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const int parsed = arm_options_parse_arg(&options, argv[i]);
+        if (parsed < 0) {
+            return 1;
+        }
+        if (parsed == 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "--speed=", strlen("--speed=")) == 0) {
+            char *end;
+            speed = strtod(argv[i] + strlen("--speed="), &end);
+            if (*end != '\0' || !(speed > 0)) {
+                fprintf(stderr, "--speed must be above 0\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--loop=", strlen("--loop=")) == 0) {
+            char *end;
+            loops = strtoul(argv[i] + strlen("--loop="), &end, 10);
+            if (*end != '\0' || end == argv[i] + strlen("--loop=")) {
+                fprintf(stderr, "--loop takes a count, 0 to repeat until interrupted\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else if (argv[i][0] != '-' && log_path == NULL) {
+            log_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (log_path == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // No SA_RESTART, so the replay's sleep returns and it sees the request
+    struct sigaction quit_action = { .sa_handler = on_quit_signal };
+    sigemptyset(&quit_action.sa_mask);
+    sigaction(SIGINT, &quit_action, NULL);
+    sigaction(SIGTERM, &quit_action, NULL);
+
+    struct command_log log;
+    if (command_log_open(&log, log_path) != 0) {
+        return 1;
+    }
+    struct arm_controller *arm = arm_controller_open(&options);
+    if (arm == NULL) {
+        command_log_close(&log);
+        return 1;
+    }
+    arm_controller_bind_source(arm, SOURCE_UI);
+
+    // Start from rest, as the recording did
+    arm_send_stop_all(arm);
+
+    struct arm_replay_stats total = { 0 };
+    const long long start_ns = monotonic_ns();
+    for (unsigned long loop = 0; (loops == 0 || loop < loops) && !quit_requested; loop++) {
+        struct arm_replay_stats stats;
+        command_log_rewind(&log);
+        arm_replay_log(arm, &log, speed, &quit_requested, &stats);
+        if (stats.sent + stats.refused == 0) {
+            break;  // empty log
+        }
+
+        total.sent += stats.sent;
+        total.refused += stats.refused;
+        for (int i = 0; i < TICK_HISTOGRAM_BUCKETS; i++) {
+            total.lateness.counts[i] += stats.lateness.counts[i];
+        }
+        if (stats.lateness.max_us > total.lateness.max_us) {
+            total.lateness.max_us = stats.lateness.max_us;
+        }
+    }
+    const long long elapsed_ns = monotonic_ns() - start_ns;
+
+    arm_send_stop_all(arm);
+
+    printf("Replayed %lu commands (%lu refused) in %.3f s at %gx\n", total.sent, total.refused,
+           (double) elapsed_ns / 1e9, speed);
+    tick_histogram_print(stdout, "Replay lateness", &total.lateness);
+    arm_controller_close(arm, stdout);
+    command_log_close(&log);
+    return 0;
+}
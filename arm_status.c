@@ -0,0 +1,113 @@
+#include "arm_status.h"
+
+#include <errno.h>
+
+#include "arm_latency.h"
+#include "arm_metrics.h"
+#include "arm_time.h"
+
+/**
+ * Tells the poller a command went out so it knows whether the arm is moving.
+ * @param moving: whether any motor is running after this command.
+ */
+void status_poller_note_command(struct status_poller *p, bool moving) {
+    pthread_mutex_lock(&p->lock);
+    p->moving = moving;
+    p->last_command_ms = monotonic_ms();
+    if (p->unacked_write_ns == 0) {
+        p->unacked_write_ns = monotonic_ns();
+    }
+    // Only wake the poller if it has backed off, otherwise it's already polling fast
+    if (p->interval_ms > STATUS_POLL_FAST_MS) {
+        p->woken = true;
+        pthread_cond_signal(&p->wake);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void status_poller_invalidate(struct status_poller *p) {
+    pthread_mutex_lock(&p->lock);
+    p->have_latest = false;
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void* status_poller_thread(void *arg) {
+    struct status_poller *p = arg;
+    char buffer[STATUS_LINE_MAX];
+
+    pthread_mutex_lock(&p->lock);
+    while (p->running) {
+        pthread_mutex_unlock(&p->lock);
+        const long long read_start_ns = monotonic_ns();
+        const ssize_t bytes_read = device_session_read(p->session, buffer, sizeof(buffer) - 1);
+        metrics_observe(METRIC_STATUS_READ, monotonic_ns() - read_start_ns);
+        pthread_mutex_lock(&p->lock);
+
+        struct robot_status status;
+        if (bytes_read > 0) {
+            buffer[bytes_read] = '\0';
+        }
+        // Only a read that started after the write can acknowledge it
+        if (bytes_read > 0 && p->unacked_write_ns != 0 && p->unacked_write_ns <= read_start_ns) {
+            latency_record(LATENCY_WRITE_TO_ACK, monotonic_ns() - p->unacked_write_ns);
+            p->unacked_write_ns = 0;
+        }
+        // Only report when something actually changed
+        if (bytes_read > 0 && parse_robot_status(buffer, &status) == 0
+                && (!p->have_latest || !robot_status_equal(&status, &p->latest))) {
+            p->latest = status;
+            p->have_latest = true;
+            if (p->on_change != NULL) {
+                pthread_mutex_unlock(&p->lock);
+                p->on_change(&status, p->data);
+                pthread_mutex_lock(&p->lock);
+            }
+        }
+
+        const long long now = monotonic_ms();
+        if (p->moving || now - p->last_command_ms < STATUS_ACTIVE_GRACE_MS) {
+            p->interval_ms = STATUS_POLL_FAST_MS;
+        } else if (p->interval_ms < STATUS_POLL_IDLE_MS) {
+            p->interval_ms *= 2;
+            if (p->interval_ms > STATUS_POLL_IDLE_MS) {
+                p->interval_ms = STATUS_POLL_IDLE_MS;
+            }
+        }
+
+        struct timespec deadline;
+        deadline_after_us(&deadline, (long) p->interval_ms * 1000);
+
+        while (p->running && !p->woken) {
+            if (pthread_cond_timedwait(&p->wake, &p->lock, &deadline) == ETIMEDOUT) break;
+        }
+        if (p->woken) {
+            p->woken = false;
+            p->interval_ms = STATUS_POLL_FAST_MS;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int status_poller_start(struct status_poller *p, struct device_session *session,
+                        status_change_fn on_change, void *data) {
+    monotonic_cond_init(&p->wake);
+
+    p->session = session;
+    p->on_change = on_change;
+    p->data = data;
+    p->running = true;
+    if (pthread_create(&p->thread, NULL, status_poller_thread, p) != 0) {
+        p->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void status_poller_stop(struct status_poller *p) {
+    pthread_mutex_lock(&p->lock);
+    p->running = false;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+}
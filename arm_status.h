@@ -0,0 +1,51 @@
+#ifndef ARM_STATUS_H
+#define ARM_STATUS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "arm_device.h"
+#include "arm_protocol.h"
+
+/*
+ * Status poller: reads the arm status on its own timer instead of after every
+ * command. It polls quickly while any joint is moving (or was just commanded)
+ * and doubles its interval up to STATUS_POLL_IDLE_MS once the arm is idle.
+ * Readings that differ from the last one are handed to on_change.
+ */
+#define STATUS_POLL_FAST_MS 50
+#define STATUS_POLL_IDLE_MS 1000
+#define STATUS_ACTIVE_GRACE_MS 500 // keep polling fast this long after the last command
+#define STATUS_LINE_MAX 512
+
+//called on the poller thread, without its lock held
+typedef void (*status_change_fn)(const struct robot_status *status, void *data);
+
+struct status_poller {
+    struct device_session *session;
+    status_change_fn on_change;  // may be NULL
+    void *data;
+    bool moving;                 // some motor was left running by the last command
+    long long last_command_ms;
+    unsigned int interval_ms;
+    bool woken;                  // a command arrived while we were backed off
+    long long unacked_write_ns;  // first write not yet followed by a status read, 0 if none
+    struct robot_status latest;
+    bool have_latest;
+    bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+#define STATUS_POLLER_INIT { .interval_ms = STATUS_POLL_FAST_MS, .lock = PTHREAD_MUTEX_INITIALIZER }
+
+int status_poller_start(struct status_poller *p, struct device_session *session,
+                        status_change_fn on_change, void *data);
+void status_poller_stop(struct status_poller *p);
+void status_poller_note_command(struct status_poller *p, bool moving);
+
+//forgets the last reading so the next one is reported even if it hasn't changed
+void status_poller_invalidate(struct status_poller *p);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef ARM_TIME_H
+#define ARM_TIME_H
+
+#include <pthread.h>
+#include <time.h>
+
+//milliseconds on the monotonic clock
+static inline long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//nanoseconds on the monotonic clock
+static inline long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static inline long long timespec_ns(const struct timespec *ts) {
+    return (long long) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static inline void timespec_add_ns(struct timespec *ts, long long ns) {
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static inline struct timespec ns_timespec(long long ns) {
+    return (struct timespec) { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+}
+
+//absolute monotonic time us microseconds from now, for pthread_cond_timedwait
+static inline void deadline_after_us(struct timespec *deadline, long us) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += us / 1000000;
+    deadline->tv_nsec += (us % 1000000) * 1000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+//timed waits use the monotonic clock so wall-clock changes don't stall them
+static inline void monotonic_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+#endif
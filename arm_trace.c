@@ -0,0 +1,227 @@
+#include "arm_trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_time.h"
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+_Static_assert(TRACE_MAX_THREADS <= 256, "ring indexes must fit a record's thread byte");
+
+const char *const trace_event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_THREAD] = "thread",
+    [TRACE_DROPPED] = "dropped",
+    [TRACE_SEND_JOINT] = "send joint",
+    [TRACE_SUPPRESSED] = "suppressed",
+    [TRACE_SEND_STOP_ALL] = "send stop:all",
+    [TRACE_SEND_RAW] = "send raw",
+    [TRACE_SEND_TEXT] = "send text",
+    [TRACE_QUEUE_FULL] = "queue full",
+    [TRACE_EMERGENCY_STOP] = "emergency stop",
+    [TRACE_UI_BUTTON] = "ui button",
+    [TRACE_UI_RAW_ENTRY] = "ui raw entry",
+    [TRACE_JOYSTICK_EVENT] = "joystick event",
+    [TRACE_DEVICE_WRITE] = "device write",
+    [TRACE_DEVICE_IOCTL] = "device ioctl",
+    [TRACE_DEVICE_ERROR] = "device error",
+    [TRACE_STOP_WRITTEN] = "stop written",
+    [TRACE_LIMIT_HELD] = "limit held",
+    [TRACE_LIMIT_REJECTED] = "limit rejected",
+    [TRACE_WATCHDOG_EXPIRED] = "watchdog expired",
+};
+
+atomic_bool trace_enabled;
+
+//one per tracing thread: only it moves tail, only the flusher moves head
+struct trace_ring {
+    struct trace_record slots[TRACE_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_ulong dropped;
+    unsigned long reported;  // drops already logged, flusher only
+};
+
+static struct trace_ring *trace_rings;  // TRACE_MAX_THREADS of them, kept until exit once allocated
+static atomic_uint trace_ring_count;    // claimed so far, may run past TRACE_MAX_THREADS
+
+//ring index of the calling thread: -1 before its first record, TRACE_MAX_THREADS if none was left
+static _Thread_local int trace_slot = -1;
+
+static struct {
+    FILE *file;
+    bool failed;
+    bool running;  // changed under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} flusher = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct trace_ring* trace_ring_self(void) {
+    if (trace_slot < 0) {
+        const unsigned int index = atomic_fetch_add(&trace_ring_count, 1);
+        trace_slot = index < TRACE_MAX_THREADS ? (int) index : TRACE_MAX_THREADS;
+    }
+    return trace_slot < TRACE_MAX_THREADS ? &trace_rings[trace_slot] : NULL;
+}
+
+void trace_emit(unsigned int level, enum trace_event event, const uint32_t args[TRACE_ARGS]) {
+    struct trace_ring *ring = trace_ring_self();
+    if (ring == NULL) return;  // more threads than rings: this one isn't traced
+
+    const unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == TRACE_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    struct trace_record *record = &ring->slots[tail & (TRACE_RING_SIZE - 1)];
+    record->time_ns = monotonic_ns();
+    record->event = (uint16_t) event;
+    record->level = (uint8_t) level;
+    record->thread = (uint8_t) trace_slot;
+    memcpy(record->args, args, sizeof(record->args));
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void trace_emit_text(unsigned int level, enum trace_event event, const char *text, size_t len) {
+    uint32_t args[TRACE_ARGS] = { 0 };
+    if (len > sizeof(args)) {
+        len = sizeof(args);
+    }
+    memcpy(args, text, len);
+    trace_emit(level, event, args);
+}
+
+void trace_name_thread(const char *name) {
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+        trace_emit_text(TRACE_LEVEL_INFO, TRACE_THREAD, name, strlen(name));
+    }
+}
+
+static void trace_write(const void *data, size_t size, size_t count) {
+    if (flusher.failed || count == 0) return;
+    if (fwrite(data, size, count, flusher.file) != count) {
+        perror("Error writing trace, tracing stopped");
+        flusher.failed = true;
+    }
+}
+
+//copies everything the rings hold to the file (flusher thread, or trace_close once it has gone)
+static void trace_drain(void) {
+    unsigned int count = atomic_load(&trace_ring_count);
+    if (count > TRACE_MAX_THREADS) {
+        count = TRACE_MAX_THREADS;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        struct trace_ring *ring = &trace_rings[i];
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        const unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        // At most two runs: up to the end of the array, then from its start
+        while (head != tail) {
+            const unsigned int start = head & (TRACE_RING_SIZE - 1);
+            unsigned int run = tail - head;
+            if (run > TRACE_RING_SIZE - start) {
+                run = TRACE_RING_SIZE - start;
+            }
+            trace_write(&ring->slots[start], sizeof(struct trace_record), run);
+            head += run;
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        const unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped != ring->reported) {
+            const struct trace_record record = {
+                .time_ns = monotonic_ns(),
+                .event = TRACE_DROPPED,
+                .level = TRACE_LEVEL_WARN,
+                .thread = (uint8_t) i,
+                .args = { (uint32_t) (dropped - ring->reported) },
+            };
+            trace_write(&record, sizeof(record), 1);
+            ring->reported = dropped;
+        }
+    }
+    if (!flusher.failed) {
+        fflush(flusher.file);
+    }
+}
+
+static void* trace_flusher_thread(void *arg) {
+    pthread_mutex_lock(&flusher.lock);
+    while (flusher.running) {
+        struct timespec deadline;
+        deadline_after_us(&deadline, TRACE_FLUSH_MS * 1000L);
+        while (flusher.running) {
+            if (pthread_cond_timedwait(&flusher.wake, &flusher.lock, &deadline) == ETIMEDOUT) break;
+        }
+        pthread_mutex_unlock(&flusher.lock);
+        trace_drain();
+        pthread_mutex_lock(&flusher.lock);
+    }
+    pthread_mutex_unlock(&flusher.lock);
+    return NULL;
+}
+
+/**
+ * Starts tracing to a new file at path. One trace per process: the rings are
+ * set up here and live until exit, so a late record never lands in freed memory.
+ * @return 0, or -1 (reported) if the file or the flusher thread can't be created.
+ */
+int trace_open(const char *path) {
+    if (trace_rings != NULL) {
+        fprintf(stderr, "Only one trace per process\n");
+        return -1;
+    }
+    trace_rings = calloc(TRACE_MAX_THREADS, sizeof(*trace_rings));
+    if (trace_rings == NULL) {
+        perror("Error allocating trace buffers");
+        return -1;
+    }
+    flusher.file = fopen(path, "wb");
+    if (flusher.file == NULL) {
+        perror("Error creating trace");
+        return -1;
+    }
+
+    uint8_t header[TRACE_FILE_HEADER_LEN] = { 0 };
+    const uint32_t version = TRACE_FILE_VERSION;
+    const uint32_t record_size = sizeof(struct trace_record);
+    const int64_t start_ns = monotonic_ns();
+    memcpy(header, TRACE_FILE_MAGIC, strlen(TRACE_FILE_MAGIC));
+    memcpy(header + 8, &version, sizeof(version));
+    memcpy(header + 12, &record_size, sizeof(record_size));
+    memcpy(header + 16, &start_ns, sizeof(start_ns));
+    trace_write(header, sizeof(header), 1);
+
+    monotonic_cond_init(&flusher.wake);
+    flusher.running = true;
+    if (pthread_create(&flusher.thread, NULL, trace_flusher_thread, NULL) != 0) {
+        perror("Failed to create trace flusher thread");
+        flusher.running = false;
+        fclose(flusher.file);
+        flusher.file = NULL;
+        return -1;
+    }
+    atomic_store(&trace_enabled, true);
+    return 0;
+}
+
+//stops tracing and writes out what the rings still hold
+void trace_close(void) {
+    if (flusher.file == NULL) return;
+    atomic_store(&trace_enabled, false);
+
+    pthread_mutex_lock(&flusher.lock);
+    flusher.running = false;
+    pthread_cond_signal(&flusher.wake);
+    pthread_mutex_unlock(&flusher.lock);
+    pthread_join(flusher.thread, NULL);
+
+    trace_drain();
+    if (fclose(flusher.file) != 0) {
+        perror("Error closing trace");
+    }
+    flusher.file = NULL;
+}
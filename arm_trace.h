@@ -0,0 +1,109 @@
+#ifndef ARM_TRACE_H
+#define ARM_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary trace log (--trace=FILE), for a full record of what the control
+ * path did without printf on it. A trace point stores one fixed-size record
+ * in a ring owned by the calling thread: no lock, no syscall, no formatting.
+ * A flusher thread drains every ring to the file a few times a second, and
+ * arm_tracedump turns the file back into text offline.
+ *
+ * Trace points less severe than ARM_TRACE_LEVEL are compiled out entirely (build with
+ * -DARM_TRACE_LEVEL=2 to keep only warnings and errors). The rest cost one
+ * load of trace_enabled while no trace file is open. A ring that fills
+ * before the flusher gets to it drops records, and the drop is logged.
+ *
+ * The file is a 24-byte header (TRACE_FILE_MAGIC, version, record size,
+ * start time) followed by records in the order they were drained, which is
+ * time order per thread only. Host byte order, like the command log.
+ */
+#define TRACE_FILE_MAGIC "A37TRACE"
+#define TRACE_FILE_VERSION 1
+#define TRACE_FILE_HEADER_LEN 24
+#define TRACE_RING_SIZE 4096  // records per thread, must be a power of two
+#define TRACE_MAX_THREADS 16
+#define TRACE_ARGS 5
+#define TRACE_FLUSH_MS 100
+
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARN 2
+#define TRACE_LEVEL_INFO 3
+#define TRACE_LEVEL_DEBUG 4
+
+#ifndef ARM_TRACE_LEVEL
+#define ARM_TRACE_LEVEL TRACE_LEVEL_DEBUG
+#endif
+
+//what a record is, and the arguments it carries
+enum trace_event {
+    TRACE_THREAD,             // a thread named itself: name
+    TRACE_DROPPED,            // the thread's ring was full: records lost
+    TRACE_SEND_JOINT,         // joint, direction, source
+    TRACE_SUPPRESSED,         // joint, direction: already doing that
+    TRACE_SEND_STOP_ALL,      // source
+    TRACE_SEND_RAW,           // var1, var2, var3
+    TRACE_SEND_TEXT,          // text
+    TRACE_QUEUE_FULL,         // kind
+    TRACE_EMERGENCY_STOP,     // source
+    TRACE_UI_BUTTON,          // joint, direction
+    TRACE_UI_RAW_ENTRY,       // var1, var2, var3
+    TRACE_JOYSTICK_EVENT,     // type, number, value
+    TRACE_DEVICE_WRITE,       // text written to the arm
+    TRACE_DEVICE_IOCTL,       // var1, var2, var3 sent to the arm
+    TRACE_DEVICE_ERROR,       // errno, 0 for a write or 1 for an ioctl
+    TRACE_STOP_WRITTEN,       // lane, latency us
+    TRACE_LIMIT_HELD,         // joint mask held back
+    TRACE_LIMIT_REJECTED,     // kind
+    TRACE_WATCHDOG_EXPIRED,   // joint, source, silent ms
+    TRACE_EVENT_COUNT
+};
+
+struct trace_record {
+    int64_t time_ns;
+    uint16_t event;
+    uint8_t level;
+    uint8_t thread;  // ring index, named by its TRACE_THREAD record
+    uint32_t args[TRACE_ARGS];
+};
+
+_Static_assert(sizeof(struct trace_record) == 32, "trace records are 32 bytes on disk");
+
+extern const char *const trace_event_names[TRACE_EVENT_COUNT];
+
+//set while a trace file is open; checked before a record is built
+extern atomic_bool trace_enabled;
+
+int trace_open(const char *path);
+void trace_close(void);
+
+void trace_emit(unsigned int level, enum trace_event event, const uint32_t args[TRACE_ARGS]);
+
+//up to TRACE_ARGS * 4 bytes of text as the record's arguments
+void trace_emit_text(unsigned int level, enum trace_event event, const char *text, size_t len);
+
+//names the calling thread in the trace; a no-op with no trace open
+void trace_name_thread(const char *name);
+
+#define TRACE_AT(level, event, ...) do { \
+        if ((level) <= ARM_TRACE_LEVEL && atomic_load_explicit(&trace_enabled, memory_order_relaxed)) { \
+            trace_emit((level), (event), (const uint32_t[TRACE_ARGS]) { __VA_ARGS__ }); \
+        } \
+    } while (0)
+
+#define TRACE_TEXT_AT(level, event, text, len) do { \
+        if ((level) <= ARM_TRACE_LEVEL && atomic_load_explicit(&trace_enabled, memory_order_relaxed)) { \
+            trace_emit_text((level), (event), (text), (len)); \
+        } \
+    } while (0)
+
+#define TRACE_ERROR(event, ...) TRACE_AT(TRACE_LEVEL_ERROR, event, __VA_ARGS__)
+#define TRACE_WARN(event, ...) TRACE_AT(TRACE_LEVEL_WARN, event, __VA_ARGS__)
+#define TRACE_INFO(event, ...) TRACE_AT(TRACE_LEVEL_INFO, event, __VA_ARGS__)
+#define TRACE_DEBUG(event, ...) TRACE_AT(TRACE_LEVEL_DEBUG, event, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Decodes a trace made with --trace into text, one line per record in time
+ * order across every thread: seconds since the trace started, thread, level,
+ * event and its arguments.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_dispatcher.h"
+#include "arm_protocol.h"
+#include "arm_trace.h"
+
+static const char *const level_names[] = {
+    [TRACE_LEVEL_ERROR] = "ERROR",
+    [TRACE_LEVEL_WARN] = "WARN",
+    [TRACE_LEVEL_INFO] = "INFO",
+    [TRACE_LEVEL_DEBUG] = "DEBUG",
+};
+
+static const char *const source_names[SOURCE_COUNT] = {
+    [SOURCE_UI] = "ui",
+    [SOURCE_JOYSTICK] = "joystick",
+    [SOURCE_MOTION] = "motion",
+    [SOURCE_WATCHDOG] = "watchdog",
+};
+
+static const char *const kind_names[] = {
+    [COMMAND_TEXT] = "text",
+    [COMMAND_IOCTL] = "raw frame",
+    [COMMAND_JOINT] = "joint",
+};
+
+//a record as read, with its place in the file so equal times keep their order
+struct dump_record {
+    struct trace_record record;
+    size_t index;
+};
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--level=1-4] TRACE\n", argv0);
+}
+
+static int dump_record_compare(const void *a, const void *b) {
+    const struct dump_record *x = a;
+    const struct dump_record *y = b;
+    if (x->record.time_ns != y->record.time_ns) {
+        return x->record.time_ns < y->record.time_ns ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+//a record's arguments as the text they hold, nul terminated
+static void record_text(const struct trace_record *record, char out[TRACE_ARGS * 4 + 1]) {
+    memcpy(out, record->args, TRACE_ARGS * 4);
+    out[TRACE_ARGS * 4] = '\0';
+}
+
+static const char* source_name(uint32_t source) {
+    return source < SOURCE_COUNT ? source_names[source] : "no source";
+}
+
+static const char* kind_name(uint32_t kind) {
+    return kind < sizeof(kind_names) / sizeof(kind_names[0]) ? kind_names[kind] : "?";
+}
+
+//"base:left", or the numbers if they aren't a joint command
+static void print_joint(uint32_t joint, uint32_t direction) {
+    if (joint < JOINT_COUNT && direction <= JOINT_NEG) {
+        printf("%s", joint_encodings[joint].text[direction]);
+    } else {
+        printf("joint %u direction %u", joint, direction);
+    }
+}
+
+//a joint bitmask as names, "all" for STOP_LANE_ALL
+static void print_joints(uint32_t mask) {
+    if (mask & STOP_LANE_ALL) {
+        printf("all");
+        return;
+    }
+    const char *separator = "";
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        if (!(mask & (1u << joint))) continue;
+        const char *name = joint_encodings[joint].text[JOINT_STOP];
+        printf("%s%.*s", separator, (int) strcspn(name, ":"), name);
+        separator = ",";
+    }
+}
+
+static void print_details(const struct trace_record *record) {
+    const uint32_t *a = record->args;
+    char text[TRACE_ARGS * 4 + 1];
+
+    switch ((enum trace_event) record->event) {
+    case TRACE_THREAD:
+    case TRACE_SEND_TEXT:
+    case TRACE_DEVICE_WRITE:
+        record_text(record, text);
+        printf("\"%s\"", text);
+        break;
+    case TRACE_DROPPED:
+        printf("%u records lost, the ring was full", a[0]);
+        break;
+    case TRACE_SEND_JOINT:
+        print_joint(a[0], a[1]);
+        printf(" from %s", source_name(a[2]));
+        break;
+    case TRACE_SUPPRESSED:
+    case TRACE_UI_BUTTON:
+        print_joint(a[0], a[1]);
+        break;
+    case TRACE_SEND_STOP_ALL:
+    case TRACE_EMERGENCY_STOP:
+        printf("from %s", source_name(a[0]));
+        break;
+    case TRACE_SEND_RAW:
+    case TRACE_UI_RAW_ENTRY:
+    case TRACE_DEVICE_IOCTL:
+        printf("%d,%d,%d", (int32_t) a[0], (int32_t) a[1], (int32_t) a[2]);
+        break;
+    case TRACE_QUEUE_FULL:
+    case TRACE_LIMIT_REJECTED:
+        printf("%s", kind_name(a[0]));
+        break;
+    case TRACE_JOYSTICK_EVENT:
+        printf("type %u number %u value %d", a[0], a[1], (int32_t) a[2]);
+        break;
+    case TRACE_DEVICE_ERROR:
+        printf("%s: %s", a[1] ? "ioctl" : "write", strerror((int) a[0]));
+        break;
+    case TRACE_STOP_WRITTEN:
+        print_joints(a[0]);
+        printf(" after %u us", a[1]);
+        break;
+    case TRACE_LIMIT_HELD:
+        print_joints(a[0]);
+        break;
+    case TRACE_WATCHDOG_EXPIRED:
+        print_joint(a[0], JOINT_STOP);
+        printf(" left moving by %s, silent %u ms", source_name(a[1]), a[2]);
+        break;
+    default:
+        printf("%u %u %u %u %u", a[0], a[1], a[2], a[3], a[4]);
+        break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    unsigned int max_level = TRACE_LEVEL_DEBUG;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--level=", strlen("--level=")) == 0) {
+            char *end;
+            const unsigned long level = strtoul(argv[i] + strlen("--level="), &end, 10);
+            if (*end != '\0' || level < TRACE_LEVEL_ERROR || level > TRACE_LEVEL_DEBUG) {
+                usage(argv[0]);
+                return 1;
+            }
+            max_level = (unsigned int) level;
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path == NULL) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Error opening trace");
+        return 1;
+    }
+    uint8_t header[TRACE_FILE_HEADER_LEN];
+    uint32_t version = 0;
+    uint32_t record_size = 0;
+    int64_t start_ns = 0;
+    if (fread(header, sizeof(header), 1, file) == 1) {
+        memcpy(&version, header + 8, sizeof(version));
+        memcpy(&record_size, header + 12, sizeof(record_size));
+        memcpy(&start_ns, header + 16, sizeof(start_ns));
+    }
+    if (memcmp(header, TRACE_FILE_MAGIC, strlen(TRACE_FILE_MAGIC)) != 0 || version != TRACE_FILE_VERSION
+            || record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "%s is not a trace this version can read\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    // Records are in the order each thread's ring was drained, so they all have to be read before sorting
+    struct dump_record *records = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    for (;;) {
+        if (count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 4096;
+            struct dump_record *grown = realloc(records, capacity * sizeof(*records));
+            if (grown == NULL) {
+                perror("Error reading trace");
+                free(records);
+                fclose(file);
+                return 1;
+            }
+            records = grown;
+        }
+        // A record cut short by a crash ends the trace
+        if (fread(&records[count].record, sizeof(struct trace_record), 1, file) != 1) break;
+        records[count].index = count;
+        count++;
+    }
+    fclose(file);
+    qsort(records, count, sizeof(*records), dump_record_compare);
+
+    char thread_names[TRACE_MAX_THREADS][TRACE_ARGS * 4 + 1] = { { 0 } };
+    unsigned long lost = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct trace_record *record = &records[i].record;
+        if (record->event == TRACE_THREAD && record->thread < TRACE_MAX_THREADS) {
+            record_text(record, thread_names[record->thread]);
+        } else if (record->event == TRACE_DROPPED) {
+            lost += record->args[0];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const struct trace_record *record = &records[i].record;
+        if (record->level > max_level) continue;
+
+        char thread[TRACE_ARGS * 4 + 1];  // a name, or "thread N"
+        if (record->thread < TRACE_MAX_THREADS && thread_names[record->thread][0] != '\0') {
+            snprintf(thread, sizeof(thread), "%s", thread_names[record->thread]);
+        } else {
+            snprintf(thread, sizeof(thread), "thread %u", record->thread);
+        }
+        const char *level = record->level >= TRACE_LEVEL_ERROR && record->level <= TRACE_LEVEL_DEBUG
+                            ? level_names[record->level] : "?";
+        const char *event = record->event < TRACE_EVENT_COUNT ? trace_event_names[record->event] : "unknown";
+
+        printf("%12.6f %-9s %-5s %-16s ", (record->time_ns - start_ns) / 1e9, thread, level, event);
+        print_details(record);
+        printf("\n");
+    }
+
+    fprintf(stderr, "%zu records, %lu lost to full rings\n", count, lost);
+    free(records);
+    return 0;
+}
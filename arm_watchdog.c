@@ -0,0 +1,154 @@
+#include "arm_watchdog.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "arm_time.h"
+
+_Static_assert((WATCHDOG_WHEEL_SLOTS & (WATCHDOG_WHEEL_SLOTS - 1)) == 0, "WATCHDOG_WHEEL_SLOTS must be a power of two");
+_Static_assert(JOINT_COUNT <= 32, "joints must fit the arming bitmask");
+
+//ticks are unsigned and wrap, so order is by difference
+static bool tick_before(unsigned int a, unsigned int b) {
+    return (int) (a - b) < 0;
+}
+
+static void watchdog_file(struct watchdog *w, struct watchdog_timer *timer, unsigned int expires) {
+    struct watchdog_timer **slot = &w->wheel[expires & (WATCHDOG_WHEEL_SLOTS - 1)];
+    timer->expires = expires;
+    timer->next = *slot;
+    timer->filed = true;
+    *slot = timer;
+}
+
+//latest sign of life for a moving joint: being set moving, or its source's heartbeat
+static unsigned int watchdog_refreshed(struct watchdog *w, enum joint joint) {
+    const unsigned int moved = atomic_load_explicit(&w->moved_at[joint], memory_order_relaxed);
+    const unsigned char source = atomic_load_explicit(&w->owner[joint], memory_order_relaxed);
+    const unsigned int beat = atomic_load_explicit(&w->heartbeat[source], memory_order_relaxed);
+    return tick_before(moved, beat) ? beat : moved;
+}
+
+static void watchdog_clear(struct watchdog *w) {
+    memset(w->wheel, 0, sizeof(w->wheel));
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        w->timers[joint].filed = false;
+    }
+}
+
+//one tick of the wheel: files newly moving joints and checks the timers due now
+static void watchdog_tick(struct watchdog *w, unsigned int now) {
+    atomic_store_explicit(&w->now, now, memory_order_relaxed);
+
+    unsigned int arming = atomic_exchange_explicit(&w->arming, 0, memory_order_acquire);
+    for (int joint = 0; arming != 0; joint++, arming >>= 1) {
+        if ((arming & 1) && !w->timers[joint].filed) {
+            watchdog_file(w, &w->timers[joint], watchdog_refreshed(w, joint) + w->deadline_ticks);
+        }
+    }
+
+    struct watchdog_timer **slot = &w->wheel[now & (WATCHDOG_WHEEL_SLOTS - 1)];
+    struct watchdog_timer *due = *slot;
+    *slot = NULL;
+    struct watchdog_timer *expired = NULL;
+    while (due != NULL) {
+        struct watchdog_timer *timer = due;
+        due = timer->next;
+        timer->filed = false;
+        const enum joint joint = (enum joint) (timer - w->timers);
+
+        if (tick_before(now, timer->expires)) {
+            watchdog_file(w, timer, timer->expires);  // not this lap
+            continue;
+        }
+        if (!w->moving(w->data, joint)) continue;
+        const unsigned int refreshed = watchdog_refreshed(w, joint);
+        if (tick_before(now, refreshed + w->deadline_ticks)) {
+            watchdog_file(w, timer, refreshed + w->deadline_ticks);
+            continue;
+        }
+        if (expired == NULL) expired = timer;
+    }
+    if (expired == NULL) return;
+
+    // One stop:all covers every joint, so every other timer goes too
+    const enum joint joint = (enum joint) (expired - w->timers);
+    const unsigned char source = atomic_load_explicit(&w->owner[joint], memory_order_relaxed);
+    const unsigned int silent_ms = (now - watchdog_refreshed(w, joint)) * WATCHDOG_TICK_MS;
+    if (w->expire(w->data, joint, (enum input_source) source, silent_ms) != 0) {
+        watchdog_file(w, expired, now + 1);
+        return;
+    }
+    atomic_fetch_add_explicit(&w->expiries, 1, memory_order_relaxed);
+    watchdog_clear(w);
+}
+
+static void* watchdog_thread(void *arg) {
+    struct watchdog *w = arg;
+    const long long start_ms = monotonic_ms();
+    unsigned int now = 0;
+
+    if (w->bind != NULL) {
+        w->bind(w->data);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while (w->running) {
+        pthread_mutex_unlock(&w->lock);
+        // Catches up slot by slot if the thread was held up, so no timer is skipped
+        const unsigned int target = (unsigned int) ((monotonic_ms() - start_ms) / WATCHDOG_TICK_MS);
+        while (tick_before(now, target)) {
+            watchdog_tick(w, ++now);
+        }
+        pthread_mutex_lock(&w->lock);
+
+        struct timespec deadline;
+        deadline_after_us(&deadline, WATCHDOG_TICK_MS * 1000L);
+        while (w->running) {
+            if (pthread_cond_timedwait(&w->wake, &w->lock, &deadline) == ETIMEDOUT) break;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/**
+ * Starts watching. Sources count as alive at start.
+ * @return 0, or -1 if the thread can't be created.
+ */
+int watchdog_start(struct watchdog *w, unsigned int deadline_ms, watchdog_moving_fn moving,
+                   watchdog_expire_fn expire, watchdog_bind_fn bind, void *data) {
+    pthread_mutex_init(&w->lock, NULL);
+    monotonic_cond_init(&w->wake);
+    w->deadline_ticks = (deadline_ms + WATCHDOG_TICK_MS - 1) / WATCHDOG_TICK_MS;
+    w->moving = moving;
+    w->expire = expire;
+    w->bind = bind;
+    w->data = data;
+    atomic_init(&w->now, 0);
+    atomic_init(&w->arming, 0);
+    atomic_init(&w->expiries, 0);
+    for (int source = 0; source < SOURCE_COUNT; source++) {
+        atomic_init(&w->heartbeat[source], 0);
+    }
+    for (int joint = 0; joint < JOINT_COUNT; joint++) {
+        atomic_init(&w->moved_at[joint], 0);
+        atomic_init(&w->owner[joint], 0);
+    }
+    watchdog_clear(w);
+
+    w->running = true;
+    if (pthread_create(&w->thread, NULL, watchdog_thread, w) != 0) {
+        w->running = false;
+        return -1;
+    }
+    return 0;
+}
+
+void watchdog_stop(struct watchdog *w) {
+    pthread_mutex_lock(&w->lock);
+    w->running = false;
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+}
@@ -0,0 +1,84 @@
+#ifndef ARM_WATCHDOG_H
+#define ARM_WATCHDOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "arm_dispatcher.h"
+#include "arm_protocol.h"
+
+/*
+ * Dead-man watchdog. Every input source that drives the arm refreshes its
+ * heartbeat while it is alive, and every joint it sets moving remembers which
+ * source that was. A joint still moving once neither it nor its source has
+ * been refreshed for the deadline (the GTK loop stalled, the pad went away
+ * with the stick deflected) gets the arm a single stop:all, however many
+ * joints were left running.
+ *
+ * The timers sit in a hashed timer wheel that only the watchdog thread
+ * touches. Senders just store the current tick number, relaxed, and only
+ * when a joint starts moving; heartbeats are one more store. When a joint's
+ * slot comes round the thread re-checks its latest refresh and re-files it
+ * if there was one, so a live source costs one re-file per deadline however
+ * many commands it sends. Memory is fixed: one timer per joint, one slot
+ * list per tick of the wheel.
+ */
+#define WATCHDOG_TICK_MS 20
+#define WATCHDOG_WHEEL_SLOTS 64  // must be a power of two; longer deadlines take several laps
+#define WATCHDOG_MIN_MS 100
+#define WATCHDOG_MAX_MS 60000
+
+//whether the joint may still be moving, called on the watchdog thread
+typedef bool (*watchdog_moving_fn)(void *data, enum joint joint);
+//stops the arm because joint (moved by source) went silent; 0 if done, -1 to retry next tick
+typedef int (*watchdog_expire_fn)(void *data, enum joint joint, enum input_source source, unsigned int silent_ms);
+//called once on the watchdog thread before its first tick
+typedef void (*watchdog_bind_fn)(void *data);
+
+struct watchdog_timer {
+    struct watchdog_timer *next;
+    unsigned int expires;  // tick
+    bool filed;
+};
+
+struct watchdog {
+    unsigned int deadline_ticks;
+    watchdog_moving_fn moving;
+    watchdog_expire_fn expire;
+    watchdog_bind_fn bind;  // may be NULL
+    void *data;
+    atomic_uint now;                        // ticks since start, only the watchdog thread moves it
+    atomic_uint heartbeat[SOURCE_COUNT];    // tick each source last said it was alive
+    atomic_uint moved_at[JOINT_COUNT];      // tick each joint was last set moving
+    atomic_uchar owner[JOINT_COUNT];        // enum input_source that did it
+    atomic_uint arming;                     // bit per joint set moving since the last tick
+    atomic_ulong expiries;                  // stops sent
+    // Watchdog thread only
+    struct watchdog_timer timers[JOINT_COUNT];
+    struct watchdog_timer *wheel[WATCHDOG_WHEEL_SLOTS];
+    bool running;                           // changed under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+int watchdog_start(struct watchdog *w, unsigned int deadline_ms, watchdog_moving_fn moving,
+                   watchdog_expire_fn expire, watchdog_bind_fn bind, void *data);
+void watchdog_stop(struct watchdog *w);
+
+//source is alive
+static inline void watchdog_heartbeat(struct watchdog *w, enum input_source source) {
+    atomic_store_explicit(&w->heartbeat[source],
+                          atomic_load_explicit(&w->now, memory_order_relaxed), memory_order_relaxed);
+}
+
+//source just set joint moving
+static inline void watchdog_arm(struct watchdog *w, enum joint joint, enum input_source source) {
+    atomic_store_explicit(&w->owner[joint], (unsigned char) source, memory_order_relaxed);
+    atomic_store_explicit(&w->moved_at[joint],
+                          atomic_load_explicit(&w->now, memory_order_relaxed), memory_order_relaxed);
+    atomic_fetch_or_explicit(&w->arming, 1u << joint, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef ARM_WIRE_H
+#define ARM_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arm_dispatcher.h"
+
+/*
+ * Protocol between arm_daemon and its clients over a SOCK_SEQPACKET Unix
+ * socket. Every request is one message and gets exactly one reply, with
+ * ARM_WIRE_REPLY set in its type. Messages are a fixed 20-byte header,
+ * followed by the command text for ARM_WIRE_TEXT. Both ends are on the same
+ * host, so fields are in host byte order.
+ */
+#define ARM_WIRE_VERSION 1
+#define ARM_WIRE_TEXT_MAX COMMAND_MAX_LEN
+#define ARM_DAEMON_SOCKET "/tmp/a37jn-arm.sock"
+#define ARM_PRIORITY_DEFAULT 100
+
+enum arm_wire_type {
+    ARM_WIRE_HELLO = 1,   // first message: arg[0] = ARM_WIRE_VERSION, arg[1] = priority
+    ARM_WIRE_JOINT,       // arg[0] = joint, arg[1] = direction
+    ARM_WIRE_STOP_ALL,
+    ARM_WIRE_RAW,         // frame = var1..var3
+    ARM_WIRE_TEXT,        // arg[0] = text length, text follows the header
+    ARM_WIRE_STATUS,      // reply: arg[0] = connected, arg[1] = command state, arg[2] = battery (0xFF if out of range or not read yet)
+    ARM_WIRE_ACQUIRE,     // take control without moving anything
+    ARM_WIRE_RELEASE,     // hand control back, the arm is stopped
+    ARM_WIRE_REPLY = 0x80
+};
+
+struct arm_wire_message {
+    uint8_t type;
+    uint8_t arg[3];
+    int32_t result;       // replies: 0, or -errno (EBUSY: another client has control)
+    int32_t frame[3];
+    char text[ARM_WIRE_TEXT_MAX];
+};
+
+#define ARM_WIRE_HEADER_LEN offsetof(struct arm_wire_message, text)
+
+_Static_assert(ARM_WIRE_HEADER_LEN == 20, "arm_wire_message header must stay 20 bytes");
+
+//where a client session connects to, the device_session target for arm_client_ops
+struct arm_client_target {
+    const char *path;
+    unsigned int priority;  // 0..255, higher takes control from lower
+};
+
+//device_session backend that goes through arm_daemon instead of opening the arm
+extern const struct device_ops arm_client_ops;
+
+#endif
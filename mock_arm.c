@@ -0,0 +1,297 @@
+#include "mock_arm.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * One request or reply on a connection. SOCK_SEQPACKET keeps each send() a
+ * separate message, so a write() on the session is exactly one command the
+ * same way it is for the real driver.
+ */
+enum mock_op {
+    MOCK_OP_WRITE = 'W',
+    MOCK_OP_READ = 'R',
+    MOCK_OP_IOCTL = 'I'
+};
+
+#define MOCK_PAYLOAD_MAX 512
+
+struct mock_message {
+    unsigned char op;
+    int result;             // reply: bytes written/read or 0, -errno on failure
+    unsigned long request;  // ioctl request number
+    unsigned int len;       // request: payload bytes (for reads: buffer size), reply: bytes that follow
+    char payload[MOCK_PAYLOAD_MAX];
+};
+
+#define MOCK_HEADER_LEN offsetof(struct mock_message, payload)
+
+static const char *const mock_command_text[] = {
+    [COMMAND_STATE_NONE] = "none",
+    [COMMAND_STATE_GOOD] = "good",
+    [COMMAND_STATE_BAD] = "bad",
+};
+
+static void mock_sleep_us(unsigned int us) {
+    if (us == 0) return;
+    struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (long) (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+    }
+}
+
+//does what the driver would do with one request and turns msg into the reply
+static void mock_arm_handle(struct mock_arm *mock, struct mock_message *msg, size_t payload_len) {
+    pthread_mutex_lock(&mock->lock);
+    unsigned int delay_us = mock->config.delay_us;
+    if (mock->config.jitter_us > 0) {
+        delay_us += (unsigned int) rand_r(&mock->seed) % (mock->config.jitter_us + 1);
+    }
+    mock->calls++;
+    const bool fail = mock->config.fail_every > 0 && mock->calls % mock->config.fail_every == 0;
+    pthread_mutex_unlock(&mock->lock);
+
+    // The "transfer" happens outside the lock so other connections aren't held up by it
+    mock_sleep_us(delay_us);
+
+    pthread_mutex_lock(&mock->lock);
+    const unsigned int capacity = msg->len;
+    msg->len = 0;
+    if (fail) {
+        mock->stats.failures++;
+        msg->result = -EIO;
+    } else if (msg->op == MOCK_OP_WRITE) {
+        enum joint joint;
+        enum joint_direction direction;
+        mock->stats.writes++;
+        if (payload_len == strlen("stop:all") && memcmp(msg->payload, "stop:all", payload_len) == 0) {
+            encode_stop_all(&mock->frame);
+            mock->command = COMMAND_STATE_GOOD;
+        } else if (parse_joint_command(msg->payload, payload_len, &joint, &direction) == 0) {
+            encode_joint(&mock->frame, joint, direction);
+            mock->command = COMMAND_STATE_GOOD;
+        } else {
+            mock->stats.rejected++;
+            mock->command = COMMAND_STATE_BAD;
+        }
+        msg->result = (int) payload_len;
+    } else if (msg->op == MOCK_OP_IOCTL) {
+        struct device_command frame;
+        mock->stats.ioctls++;
+        if (msg->request != IOCTL_SET_VALUE || payload_len != sizeof(frame)) {
+            msg->result = -ENOTTY;
+        } else {
+            memcpy(&frame, msg->payload, sizeof(frame));
+            if (frame_is_valid(&frame)) {
+                mock->frame = frame;
+                mock->command = COMMAND_STATE_GOOD;
+                msg->result = 0;
+            } else {
+                mock->stats.rejected++;
+                mock->command = COMMAND_STATE_BAD;
+                msg->result = -EINVAL;
+            }
+        }
+    } else if (msg->op == MOCK_OP_READ) {
+        mock->stats.reads++;
+        const int len = snprintf(msg->payload, sizeof(msg->payload), "connected:yes status:%s battery:%d\n",
+                                 mock_command_text[mock->command], mock->config.battery);
+        msg->len = (unsigned int) len < capacity ? (unsigned int) len : capacity;
+        msg->result = (int) msg->len;
+    } else {
+        msg->result = -EINVAL;
+    }
+    pthread_mutex_unlock(&mock->lock);
+}
+
+static void* mock_connection_serve(void *arg) {
+    struct mock_connection *conn = arg;
+    struct mock_message msg;
+
+    for (;;) {
+        const ssize_t received = recv(conn->fd, &msg, sizeof(msg), 0);
+        if (received == -1 && errno == EINTR) continue;
+        if (received < (ssize_t) MOCK_HEADER_LEN) break;  // hung up (or garbage)
+
+        mock_arm_handle(conn->mock, &msg, (size_t) received - MOCK_HEADER_LEN);
+        if (send(conn->fd, &msg, MOCK_HEADER_LEN + msg.len, MSG_NOSIGNAL) == -1) break;
+    }
+
+    pthread_mutex_lock(&conn->mock->lock);
+    conn->finished = true;
+    pthread_mutex_unlock(&conn->mock->lock);
+    return NULL;
+}
+
+/*
+ * Joins a connection whose client has gone (the slot must be used). The lock
+ * may only be held if the connection has finished: its thread sets finished
+ * as its last use of the lock, so it can't be waiting for it. Otherwise the
+ * lock must not be held, or the join could wait on a thread that wants it.
+ */
+static void mock_connection_reap(struct mock_connection *conn) {
+    pthread_join(conn->thread, NULL);
+    close(conn->fd);
+    conn->used = false;
+    conn->finished = false;
+}
+
+static int mock_arm_open(void *target) {
+    struct mock_arm *mock = target;
+    struct mock_connection *slot = NULL;
+
+    pthread_mutex_lock(&mock->lock);
+    for (int i = 0; i < MOCK_ARM_MAX_CONNECTIONS; i++) {
+        struct mock_connection *conn = &mock->connections[i];
+        if (conn->used && conn->finished) {
+            // Its thread is past its last use of the lock, so joining it here is safe
+            mock_connection_reap(conn);
+        }
+        if (!conn->used && slot == NULL) {
+            slot = conn;
+        }
+    }
+    if (slot == NULL) {
+        pthread_mutex_unlock(&mock->lock);
+        errno = EMFILE;
+        return -1;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        pthread_mutex_unlock(&mock->lock);
+        return -1;
+    }
+    slot->fd = sv[1];
+    slot->mock = mock;
+    slot->finished = false;
+    const int err = pthread_create(&slot->thread, NULL, mock_connection_serve, slot);
+    if (err != 0) {
+        pthread_mutex_unlock(&mock->lock);
+        close(sv[0]);
+        close(sv[1]);
+        errno = err;
+        return -1;
+    }
+    slot->used = true;
+    pthread_mutex_unlock(&mock->lock);
+    return sv[0];
+}
+
+//sends a request and waits for its reply; -1 with errno set if it failed either way
+static int mock_arm_call(int fd, struct mock_message *msg, size_t payload_len) {
+    if (send(fd, msg, MOCK_HEADER_LEN + payload_len, MSG_NOSIGNAL) == -1) {
+        return -1;
+    }
+    ssize_t received;
+    do {
+        received = recv(fd, msg, sizeof(*msg), 0);
+    } while (received == -1 && errno == EINTR);
+    if (received < (ssize_t) MOCK_HEADER_LEN) {
+        if (received >= 0) errno = EPIPE;
+        return -1;
+    }
+    if (msg->result < 0) {
+        errno = -msg->result;
+        return -1;
+    }
+    return msg->result;
+}
+
+static ssize_t mock_arm_write(int fd, const void *buf, size_t len) {
+    struct mock_message msg = { .op = MOCK_OP_WRITE };
+    if (len > sizeof(msg.payload)) {
+        len = sizeof(msg.payload);
+    }
+    msg.len = (unsigned int) len;
+    memcpy(msg.payload, buf, len);
+    return mock_arm_call(fd, &msg, len);
+}
+
+static ssize_t mock_arm_read(int fd, void *buf, size_t len) {
+    struct mock_message msg = { .op = MOCK_OP_READ };
+    msg.len = len < sizeof(msg.payload) ? (unsigned int) len : sizeof(msg.payload);
+    const int result = mock_arm_call(fd, &msg, 0);
+    if (result > 0) {
+        memcpy(buf, msg.payload, (size_t) result);
+    }
+    return result;
+}
+
+static int mock_arm_ioctl(int fd, unsigned long request, void *arg) {
+    struct mock_message msg = { .op = MOCK_OP_IOCTL, .request = request };
+    const size_t len = request == IOCTL_SET_VALUE ? sizeof(struct device_command) : 0;
+    msg.len = (unsigned int) len;
+    memcpy(msg.payload, arg, len);
+    return mock_arm_call(fd, &msg, len) == -1 ? -1 : 0;
+}
+
+const struct device_ops mock_arm_ops = {
+    .open = mock_arm_open,
+    .write = mock_arm_write,
+    .read = mock_arm_read,
+    .ioctl = mock_arm_ioctl,
+};
+
+void mock_arm_init(struct mock_arm *mock, const struct mock_arm_config *config) {
+    memset(mock, 0, sizeof(*mock));
+    pthread_mutex_init(&mock->lock, NULL);
+    mock->config = *config;
+    mock->command = COMMAND_STATE_NONE;
+    mock->seed = (unsigned int) time(NULL);
+}
+
+void mock_arm_destroy(struct mock_arm *mock) {
+    pthread_mutex_lock(&mock->lock);
+    for (int i = 0; i < MOCK_ARM_MAX_CONNECTIONS; i++) {
+        if (mock->connections[i].used) {
+            shutdown(mock->connections[i].fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&mock->lock);
+
+    for (int i = 0; i < MOCK_ARM_MAX_CONNECTIONS; i++) {
+        if (mock->connections[i].used) {
+            mock_connection_reap(&mock->connections[i]);
+        }
+    }
+    pthread_mutex_destroy(&mock->lock);
+}
+
+void mock_arm_get_stats(struct mock_arm *mock, struct mock_arm_stats *out) {
+    pthread_mutex_lock(&mock->lock);
+    *out = mock->stats;
+    pthread_mutex_unlock(&mock->lock);
+}
+
+int mock_arm_parse_config(const char *spec, struct mock_arm_config *out) {
+    unsigned long values[4] = { 0, 0, 0, BATTERY_MAX };
+    const char *p = spec;
+
+    for (int i = 0; i < 4; i++) {
+        char *end;
+        if (*p < '0' || *p > '9') return -1;
+        values[i] = strtoul(p, &end, 10);
+        p = end;
+        if (*p == '\0') break;
+        if (*p != ',' || i == 3) return -1;
+        p++;
+    }
+    // Delay and jitter are added together per call, so each is held well short of overflowing
+    if (values[0] > MOCK_ARM_MAX_DELAY_US || values[1] > UINT_MAX || values[2] > MOCK_ARM_MAX_DELAY_US
+            || values[3] > BATTERY_MAX) {
+        return -1;
+    }
+
+    out->delay_us = (unsigned int) values[0];
+    out->fail_every = (unsigned int) values[1];
+    out->jitter_us = (unsigned int) values[2];
+    out->battery = (int) values[3];
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef MOCK_ARM_H
+#define MOCK_ARM_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "arm_device.h"
+#include "arm_protocol.h"
+
+/*
+ * Stand-in for the A37JN driver so the command path can be run and measured
+ * without the arm. Each device_session open gets its own SOCK_SEQPACKET
+ * socketpair served by a thread that speaks the driver's protocols: text
+ * commands through write(), IOCTL_SET_VALUE frames, and a status line on
+ * read(). Every call can be slowed down and made to fail on purpose.
+ */
+#define MOCK_ARM_MAX_CONNECTIONS 4
+#define MOCK_ARM_MAX_DELAY_US 10000000  // for DELAY_US and JITTER_US each
+
+struct mock_arm_config {
+    unsigned int delay_us;    // added to every call
+    unsigned int jitter_us;   // up to this much more, picked at random per call
+    unsigned int fail_every;  // every Nth call fails with EIO, 0 = never
+    int battery;              // 0..BATTERY_MAX reported in the status line
+};
+
+#define MOCK_ARM_CONFIG_DEFAULT { .delay_us = 0, .jitter_us = 0, .fail_every = 0, .battery = BATTERY_MAX }
+
+struct mock_arm_stats {
+    unsigned long writes;
+    unsigned long reads;
+    unsigned long ioctls;
+    unsigned long failures;   // injected by fail_every
+    unsigned long rejected;   // commands the "driver" didn't understand
+};
+
+struct mock_connection {
+    bool used;
+    bool finished;            // client hung up, the thread can be joined
+    int fd;                   // server end, closed by whoever joins the thread
+    pthread_t thread;
+    struct mock_arm *mock;
+};
+
+struct mock_arm {
+    struct mock_arm_config config;
+    pthread_mutex_t lock;
+    struct device_command frame;    // what the motors were last told
+    enum command_state command;     // whether the last command was understood
+    unsigned long calls;
+    unsigned int seed;
+    struct mock_arm_stats stats;
+    struct mock_connection connections[MOCK_ARM_MAX_CONNECTIONS];
+};
+
+//device_session backend, use with the mock arm as the target
+extern const struct device_ops mock_arm_ops;
+
+void mock_arm_init(struct mock_arm *mock, const struct mock_arm_config *config);
+//hangs up on every client and waits for the serving threads
+void mock_arm_destroy(struct mock_arm *mock);
+void mock_arm_get_stats(struct mock_arm *mock, struct mock_arm_stats *out);
+
+/**
+ * Parses "DELAY_US[,FAIL_EVERY[,JITTER_US[,BATTERY]]]" as given to --mock=.
+ * @return 0 on success, -1 if spec isn't in that form or a value is out of
+ * range: delay and jitter up to MOCK_ARM_MAX_DELAY_US, battery 0..BATTERY_MAX.
+ */
+int mock_arm_parse_config(const char *spec, struct mock_arm_config *out);
+
+#endif